@@ -14,6 +14,7 @@ typedef struct Ast_TypeExpr Ast_TypeExpr;
 typedef struct Expr_BinOp Expr_BinOp;
 typedef struct Expr_FnCall Expr_FnCall;
 typedef struct Expr_Lit Expr_Lit;
+typedef struct Expr_AsType Expr_AsType;
 
 typedef struct Stmt_Assign Stmt_Assign;
 typedef struct Stmt_Label Stmt_Label;
@@ -27,16 +28,40 @@ struct Expr_BinOp {
     enum {
         BinOp_plus,
         BinOp_minus,
+        BinOp_mul,
+        BinOp_div,
+
+        BinOp_eq,
+        BinOp_nEq,
+        BinOp_lt,
+        BinOp_gt,
+        BinOp_ltEq,
+        BinOp_gtEq,
+
+        BinOp_boolAnd,
+        BinOp_boolOr,
+
+        BinOp_binAnd,
+        BinOp_binOr,
+        BinOp_xOr,
+        BinOp_lShift,
+        BinOp_rShift,
     } type;
 
     Ast_Expr *left;
     Ast_Expr *right;
+
+    // int arithmetic an optimizer computes ahead of the code that used it,
+    // where the program may never have evaluated it. it wraps on overflow
+    // instead of being undefined.
+    bool wraps;
 };
 
 struct Expr_FnCall {
     Ast_Expr *head;
     size_t argc;
     Ast_Expr *argv;
+    SrcSpan span;
 };
 
 struct Expr_Lit {
@@ -48,6 +73,11 @@ struct Expr_Lit {
     };
 };
 
+struct Expr_AsType {
+    Ast_Expr *expr;
+    Ast_TypeExpr *type;
+};
+
 struct Ast_Expr {
     enum {
         Expr_binOp,
@@ -65,6 +95,7 @@ struct Ast_Expr {
         Expr_FnCall *fnCall;
         char *ptr;
         Ast_Expr *val;
+        Expr_AsType *asType;
         Expr_Lit *lit;
     };
 };
@@ -81,7 +112,9 @@ struct Stmt_Label {
 
 struct Stmt_If {
     Ast_Expr *cond;
-    Ast_Stmt *stmt;
+    // a single statement, or the statements of a braced block
+    size_t stmtc;
+    Ast_Stmt *stmtv;
 };
 
 struct Ast_Stmt {
@@ -92,28 +125,46 @@ struct Ast_Stmt {
         Stmt_return,
         Stmt_expr,
         Stmt_break,
-        Stmt_label
+        Stmt_label,
+        Stmt_goto
     } type;
 
     union {
         Decl_Var *decl;
         Stmt_Assign *assign;
         Stmt_If *if_stmt;
+        // NULL for a bare `return;`
         Ast_Expr *return_stmt;
         Ast_Expr *expr;
+        Stmt_Label *label;
+        // name of the target label
+        char *goto_stmt;
     };
+
+    // where the statement is in the source
+    SrcSpan span;
 };
 
 // Type Expressions ////////////////////////////////////////////////////////////
 struct Ast_TypeExpr {
-    enum { TypeExpr_int, TypeExpr_bool, TypeExpr_ptr, TypeExpr_const } type;
+    enum {
+        TypeExpr_void,
+        TypeExpr_int,
+        TypeExpr_bool,
+        TypeExpr_ptr,
+        TypeExpr_const
+    } type;
 
     Ast_TypeExpr *inner;
 };
 
 // Declarations ////////////////////////////////////////////////////////////////
 struct Decl_Var {
+    char *name;
     bool is_const;
+    // set when the variable's address never escapes its function, so it can
+    // live in a register. see `opt/escape.h`.
+    bool in_register;
     Ast_TypeExpr *type;
     Ast_Expr *init;
 };
@@ -122,8 +173,18 @@ struct Decl_Fn {
     char *name;
     size_t argc;
     Decl_Var *argv;
+    // NULL for `void`
+    Ast_TypeExpr *ret_type;
     size_t stmtc;
     Ast_Stmt *stmtv;
+    SrcSpan span;
+
+    // set when a lazy parse skipped the body: `stmtv` stays empty until
+    // `Parser_parseBody()` parses the tokens in [body_start, body_end). the
+    // optimizers and the C backend assert every body they see is parsed.
+    bool body_pending;
+    size_t body_start;
+    size_t body_end;
 };
 
 struct Ast_Decl {
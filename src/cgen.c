@@ -0,0 +1,1111 @@
+#include "cgen.h"
+#include "common/bytebuf.h"
+#include "common/macros.h"
+#include <stdint.h>
+#include <string.h>
+
+// output is buffered up to this much before it is written out
+#define FLUSH_AT (64 * 1024)
+
+// a branch is hinted once it was evaluated this often and went the same way
+// at least 9 times in 10
+#define HINT_MIN_COUNT 16
+
+typedef struct Site {
+    Pgo_Kind kind;
+    const SrcSpan *span;
+} Site;
+
+typedef struct CGen {
+    ByteBuf buf;
+    FILE *out;
+    bool ok;
+
+    const Pgo_Profile *profile;
+
+    // counters are only placed in function bodies, global initializers
+    // have to stay constant
+    bool instrument;
+    bool inFn;
+    Site *sites;
+    size_t sitec;
+} CGen;
+
+// Writer //////////////////////////////////////////////////////////////////////
+
+static void flush(CGen *g) {
+    size_t len = g->buf.len;
+    if (len > 0 && fwrite(g->buf.data, 1, len, g->out) != len)
+        g->ok = false;
+    g->buf.len = 0;
+}
+
+static void putArr(CGen *g, const char *s, size_t len) {
+    ByteBuf_appendArr(&g->buf, s, len);
+    if (g->buf.len >= FLUSH_AT)
+        flush(g);
+}
+
+static void put(CGen *g, const char *s) { putArr(g, s, strlen(s)); }
+
+static void putNum(CGen *g, size_t n) {
+    char digits[24];
+    int len = snprintf(digits, sizeof digits, "%zu", n);
+    putArr(g, digits, (size_t)len);
+}
+
+static void putName(CGen *g, const char *name) {
+    put(g, "l1");
+    put(g, name);
+}
+
+static void indent(CGen *g, unsigned depth) {
+    for (unsigned i = 0; i < depth; i++)
+        put(g, "    ");
+}
+
+static void putString(CGen *g, const char *s) {
+    put(g, "\"");
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            char escaped[] = {'\\', (char)c};
+            putArr(g, escaped, 2);
+        } else if (c < ' ' || c > '~') {
+            char octal[8];
+            snprintf(octal, sizeof octal, "\\%03o", c);
+            put(g, octal);
+        } else {
+            putArr(g, (const char *)&c, 1);
+        }
+    }
+    put(g, "\"");
+}
+
+// Instrumentation /////////////////////////////////////////////////////////////
+
+static void walkSitesExpr(const Ast_Expr *e, size_t *n) {
+    switch (e->type) {
+    case Expr_binOp:
+        walkSitesExpr(e->binOp->left, n);
+        walkSitesExpr(e->binOp->right, n);
+        break;
+    case Expr_fnCall:
+        (*n)++;
+        walkSitesExpr(e->fnCall->head, n);
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            walkSitesExpr(&e->fnCall->argv[i], n);
+        break;
+    case Expr_val:
+        walkSitesExpr(e->val, n);
+        break;
+    case Expr_asType:
+        walkSitesExpr(e->asType->expr, n);
+        break;
+    case Expr_ptr:
+    case Expr_ident:
+    case Expr_lit:
+        break;
+    }
+}
+
+static void walkSitesStmts(const Ast_Stmt *stmtv, size_t stmtc, size_t *n);
+
+static void walkSitesStmt(const Ast_Stmt *stmt, size_t *n) {
+    switch (stmt->type) {
+    case Stmt_decl:
+        if (stmt->decl->init != NULL)
+            walkSitesExpr(stmt->decl->init, n);
+        break;
+    case Stmt_assign:
+        walkSitesExpr(stmt->assign->lvalue, n);
+        walkSitesExpr(stmt->assign->rvalue, n);
+        break;
+    case Stmt_if:
+        *n += 2;
+        walkSitesExpr(stmt->if_stmt->cond, n);
+        walkSitesStmts(stmt->if_stmt->stmtv, stmt->if_stmt->stmtc, n);
+        break;
+    case Stmt_return:
+        if (stmt->return_stmt != NULL)
+            walkSitesExpr(stmt->return_stmt, n);
+        break;
+    case Stmt_expr:
+        walkSitesExpr(stmt->expr, n);
+        break;
+    case Stmt_label:
+        (*n)++;
+        if (stmt->label->stmt != NULL)
+            walkSitesStmt(stmt->label->stmt, n);
+        break;
+    case Stmt_break:
+    case Stmt_goto:
+        break;
+    }
+}
+
+static void walkSitesStmts(const Ast_Stmt *stmtv, size_t stmtc, size_t *n) {
+    for (size_t i = 0; i < stmtc; i++)
+        walkSitesStmt(&stmtv[i], n);
+}
+
+// the number of counters the functions of `m` need
+static size_t countSites(const Ast_Module *m) {
+    size_t n = 0;
+    for (size_t i = 0; i < m->declc; i++) {
+        const Decl_Fn *fn = &m->declv[i].fn;
+        if (m->declv[i].type != Decl_fn)
+            continue;
+        n++;
+        walkSitesStmts(fn->stmtv, fn->stmtc, &n);
+    }
+    return n;
+}
+
+// writes `l1prof_counts[i]` for a new site
+static void putCounter(CGen *g, Pgo_Kind kind, const SrcSpan *span) {
+    g->sites[g->sitec] = (Site){.kind = kind, .span = span};
+    put(g, "l1prof_counts[");
+    putNum(g, g->sitec++);
+    put(g, "]++");
+}
+
+static void putCounterStmt(CGen *g, Pgo_Kind kind, const SrcSpan *span,
+                           unsigned depth) {
+    indent(g, depth);
+    putCounter(g, kind, span);
+    put(g, ";\n");
+}
+
+// the index of the document of `span` in the docs table
+static size_t docIndex(const char **docs, size_t *docc, const SrcSpan *span) {
+    const char *doc = span->docName != NULL ? span->docName : "";
+    for (size_t i = 0; i < *docc; i++) {
+        if (!strcmp(docs[i], doc))
+            return i;
+    }
+    docs[*docc] = doc;
+    return (*docc)++;
+}
+
+// the site tables and the exit hook that appends the counts to the profile,
+// in the format `Pgo_read()` expects
+static void emitProfileWriter(CGen *g) {
+    const char **docs = malloc(g->sitec * sizeof(char *));
+    size_t *siteDocs = malloc(g->sitec * sizeof(size_t));
+    assert(docs != NULL && siteDocs != NULL);
+    size_t docc = 0;
+    for (size_t i = 0; i < g->sitec; i++)
+        siteDocs[i] = docIndex(docs, &docc, g->sites[i].span);
+
+    put(g, "\nstatic const char *const l1prof_docs[] = {\n");
+    for (size_t i = 0; i < docc; i++) {
+        indent(g, 1);
+        putString(g, docs[i]);
+        put(g, ",\n");
+    }
+    put(g, "};\n"
+           "\n"
+           "static const struct {\n"
+           "    unsigned char kind;\n"
+           "    unsigned doc;\n"
+           "    uint64_t row, col;\n"
+           "} l1prof_sites[] = {\n");
+    for (size_t i = 0; i < g->sitec; i++) {
+        put(g, "    {");
+        putNum(g, g->sites[i].kind);
+        put(g, ", ");
+        putNum(g, siteDocs[i]);
+        put(g, ", ");
+        putNum(g, g->sites[i].span->start.row);
+        put(g, ", ");
+        putNum(g, g->sites[i].span->start.col);
+        put(g, "},\n");
+    }
+    put(g, "};\n"
+           "\n"
+           "static void l1prof_put(FILE *f, uint64_t v) {\n"
+           "    for (; v >= 0x80; v >>= 7)\n"
+           "        fputc((int)(v & 0x7f) | 0x80, f);\n"
+           "    fputc((int)v, f);\n"
+           "}\n"
+           "\n"
+           "static void l1prof_write(void) {\n"
+           "    const size_t docc = sizeof l1prof_docs / sizeof *l1prof_docs;\n"
+           "    const size_t sitec =\n"
+           "        sizeof l1prof_sites / sizeof *l1prof_sites;\n"
+           "    const char *path = getenv(\"LANG1_PROFILE\");\n"
+           "    if (path == NULL)\n"
+           "        path = \"lang1.prof\";\n"
+           "    FILE *f = fopen(path, \"ab\");\n"
+           "    if (f == NULL)\n"
+           "        return;\n"
+           "    fputs(\"L1PROF1\\n\", f);\n"
+           "    l1prof_put(f, docc);\n"
+           "    for (size_t i = 0; i < docc; i++) {\n"
+           "        size_t len = strlen(l1prof_docs[i]);\n"
+           "        l1prof_put(f, len);\n"
+           "        fwrite(l1prof_docs[i], 1, len, f);\n"
+           "    }\n"
+           "    l1prof_put(f, sitec);\n"
+           "    for (size_t i = 0; i < sitec; i++) {\n"
+           "        l1prof_put(f, l1prof_sites[i].kind);\n"
+           "        l1prof_put(f, l1prof_sites[i].doc);\n"
+           "        l1prof_put(f, l1prof_sites[i].row);\n"
+           "        l1prof_put(f, l1prof_sites[i].col);\n"
+           "        l1prof_put(f, l1prof_counts[i]);\n"
+           "    }\n"
+           "    fclose(f);\n"
+           "}\n"
+           "\n"
+           "#ifdef __GNUC__\n"
+           "__attribute__((constructor)) static void l1prof_init(void) {\n"
+           "    atexit(l1prof_write);\n"
+           "}\n"
+           "#endif\n");
+
+    free(docs);
+    free(siteDocs);
+}
+
+// the hint for an `if`, NULL for none
+static const char *branchHint(const CGen *g, const SrcSpan *span) {
+    if (g->profile == NULL)
+        return NULL;
+    uint64_t entered = Pgo_count(g->profile, Pgo_ifEntered, span);
+    uint64_t taken = Pgo_count(g->profile, Pgo_ifTaken, span);
+    if (entered < HINT_MIN_COUNT || taken > entered)
+        return NULL;
+    if (taken >= entered - entered / 10)
+        return "L1_LIKELY(";
+    if (taken <= entered / 10)
+        return "L1_UNLIKELY(";
+    return NULL;
+}
+
+static bool isCold(const CGen *g, const Decl_Fn *fn) {
+    uint64_t count;
+    return g->profile != NULL &&
+           Pgo_lookup(g->profile, Pgo_fnEntry, &fn->span, &count) &&
+           count == 0;
+}
+
+// Types ///////////////////////////////////////////////////////////////////////
+
+// writes `t` east-const style. returns true if it ends in a `*`, so the
+// declarator can be written without a space.
+static bool emitType(CGen *g, const Ast_TypeExpr *t) {
+    if (t == NULL) {
+        put(g, "void");
+        return false;
+    }
+
+    switch (t->type) {
+    case TypeExpr_void:
+        put(g, "void");
+        return false;
+    case TypeExpr_int:
+        put(g, "int64_t");
+        return false;
+    case TypeExpr_bool:
+        put(g, "bool");
+        return false;
+    case TypeExpr_ptr:
+        emitType(g, t->inner);
+        put(g, " *");
+        return true;
+    case TypeExpr_const:
+        put(g, emitType(g, t->inner) ? "const" : " const");
+        return false;
+    }
+    return false;
+}
+
+static void emitDeclarator(CGen *g, const Ast_TypeExpr *t, bool isConst,
+                           const char *name) {
+    bool star = emitType(g, t);
+    if (isConst && (t == NULL || t->type != TypeExpr_const)) {
+        put(g, star ? "const" : " const");
+        star = false;
+    }
+    if (!star)
+        put(g, " ");
+    putName(g, name);
+}
+
+// Expressions /////////////////////////////////////////////////////////////////
+
+static const char *binOpText[] = {
+    [BinOp_plus] = " + ",     [BinOp_minus] = " - ",  [BinOp_mul] = " * ",
+    [BinOp_div] = " / ",      [BinOp_eq] = " == ",    [BinOp_nEq] = " != ",
+    [BinOp_lt] = " < ",       [BinOp_gt] = " > ",     [BinOp_ltEq] = " <= ",
+    [BinOp_gtEq] = " >= ",    [BinOp_boolAnd] = " && ",
+    [BinOp_boolOr] = " || ",  [BinOp_binAnd] = " & ", [BinOp_binOr] = " | ",
+    [BinOp_xOr] = " ^ ",      [BinOp_lShift] = " << ",
+    [BinOp_rShift] = " >> ",
+};
+
+static void emitExpr(CGen *g, const Ast_Expr *e, bool nested);
+
+static void emitLit(CGen *g, const Expr_Lit *lit) {
+    if (lit->type == Lit_bool) {
+        put(g, lit->boolean ? "true" : "false");
+        return;
+    }
+
+    // literals are int64_t like everything else, or arithmetic on them alone
+    // would be done in C's narrower `int`. negative ones are stored two's
+    // complement. INT64_MIN has no literal of its own, so they are all
+    // written as -(~n) - 1.
+    if (lit->integer > INT64_MAX) {
+        put(g, "(-INT64_C(");
+        putNum(g, ~lit->integer);
+        put(g, ") - 1)");
+    } else {
+        put(g, "INT64_C(");
+        putNum(g, lit->integer);
+        put(g, ")");
+    }
+}
+
+// the operators that overflow signed ints
+static bool canOverflow(int op) {
+    return op == BinOp_plus || op == BinOp_minus || op == BinOp_mul ||
+           op == BinOp_lShift;
+}
+
+static bool isWrapping(const Ast_Expr *e) {
+    return e->type == Expr_binOp && e->binOp->wraps &&
+           canOverflow(e->binOp->type);
+}
+
+// writes `e` as a parenthesized `uint64_t` expression
+static void emitUnsigned(CGen *g, const Ast_Expr *e) {
+    if (!isWrapping(e)) {
+        put(g, "(uint64_t)");
+        emitExpr(g, e, true);
+        return;
+    }
+    put(g, "(");
+    emitUnsigned(g, e->binOp->left);
+    put(g, binOpText[e->binOp->type]);
+    emitUnsigned(g, e->binOp->right);
+    put(g, ")");
+}
+
+// `nested` expressions are parenthesized whenever precedence could matter
+static void emitExpr(CGen *g, const Ast_Expr *e, bool nested) {
+    switch (e->type) {
+    case Expr_binOp:
+        // unsigned arithmetic wraps, and converting back is defined by every
+        // compiler lang1 targets
+        if (isWrapping(e)) {
+            put(g, "(int64_t)");
+            emitUnsigned(g, e);
+            break;
+        }
+        if (nested)
+            put(g, "(");
+        emitExpr(g, e->binOp->left, true);
+        put(g, binOpText[e->binOp->type]);
+        emitExpr(g, e->binOp->right, true);
+        if (nested)
+            put(g, ")");
+        break;
+    case Expr_fnCall: {
+        const Expr_FnCall *call = e->fnCall;
+        bool counted = g->instrument && g->inFn;
+        if (counted) {
+            put(g, "(");
+            putCounter(g, Pgo_call, &call->span);
+            put(g, ", ");
+        }
+        emitExpr(g, call->head, true);
+        put(g, "(");
+        for (size_t i = 0; i < call->argc; i++) {
+            if (i > 0)
+                put(g, ", ");
+            emitExpr(g, &call->argv[i], false);
+        }
+        put(g, counted ? "))" : ")");
+        break;
+    }
+    case Expr_ptr:
+        put(g, "&");
+        putName(g, e->ptr);
+        break;
+    case Expr_val:
+        put(g, "*");
+        emitExpr(g, e->val, true);
+        break;
+    case Expr_asType:
+        put(g, "((");
+        emitType(g, e->asType->type);
+        put(g, ")");
+        emitExpr(g, e->asType->expr, true);
+        put(g, ")");
+        break;
+    case Expr_ident:
+        putName(g, e->ident);
+        break;
+    case Expr_lit:
+        emitLit(g, e->lit);
+        break;
+    }
+}
+
+// Statements //////////////////////////////////////////////////////////////////
+
+static void emitStmts(CGen *g, size_t stmtc, const Ast_Stmt *stmtv,
+                      unsigned depth);
+
+static void emitLocal(CGen *g, const Decl_Var *v, unsigned depth) {
+    indent(g, depth);
+    emitDeclarator(g, v->type, v->is_const, v->name);
+    if (v->init != NULL) {
+        put(g, " = ");
+        emitExpr(g, v->init, false);
+    }
+    put(g, ";\n");
+}
+
+static void emitStmt(CGen *g, const Ast_Stmt *stmt, unsigned depth) {
+    switch (stmt->type) {
+    case Stmt_decl:
+        emitLocal(g, stmt->decl, depth);
+        break;
+    case Stmt_assign:
+        indent(g, depth);
+        emitExpr(g, stmt->assign->lvalue, false);
+        put(g, " = ");
+        emitExpr(g, stmt->assign->rvalue, false);
+        put(g, ";\n");
+        break;
+    case Stmt_if: {
+        if (g->instrument)
+            putCounterStmt(g, Pgo_ifEntered, &stmt->span, depth);
+        const char *hint = branchHint(g, &stmt->span);
+        indent(g, depth);
+        put(g, "if (");
+        if (hint != NULL)
+            put(g, hint);
+        emitExpr(g, stmt->if_stmt->cond, false);
+        put(g, hint != NULL ? ")) {\n" : ") {\n");
+        if (g->instrument)
+            putCounterStmt(g, Pgo_ifTaken, &stmt->span, depth + 1);
+        emitStmts(g, stmt->if_stmt->stmtc, stmt->if_stmt->stmtv, depth + 1);
+        indent(g, depth);
+        put(g, "}\n");
+        break;
+    }
+    case Stmt_return:
+        indent(g, depth);
+        if (stmt->return_stmt == NULL) {
+            put(g, "return;\n");
+            break;
+        }
+        put(g, "return ");
+        emitExpr(g, stmt->return_stmt, false);
+        put(g, ";\n");
+        break;
+    case Stmt_expr:
+        indent(g, depth);
+        emitExpr(g, stmt->expr, false);
+        put(g, ";\n");
+        break;
+    case Stmt_break:
+        // lang1 has no loop for a `break` to leave, the checker rejects it
+        break;
+    case Stmt_label:
+        // the empty statement keeps a declaration after the label legal
+        indent(g, depth);
+        putName(g, stmt->label->name);
+        put(g, ":;\n");
+        if (g->instrument)
+            putCounterStmt(g, Pgo_label, &stmt->span, depth);
+        if (stmt->label->stmt != NULL)
+            emitStmt(g, stmt->label->stmt, depth);
+        break;
+    case Stmt_goto:
+        indent(g, depth);
+        put(g, "goto ");
+        putName(g, stmt->goto_stmt);
+        put(g, ";\n");
+        break;
+    }
+}
+
+static void emitStmts(CGen *g, size_t stmtc, const Ast_Stmt *stmtv,
+                      unsigned depth) {
+    for (size_t i = 0; i < stmtc; i++)
+        emitStmt(g, &stmtv[i], depth);
+}
+
+// Declarations ////////////////////////////////////////////////////////////////
+
+static void emitSignature(CGen *g, const Ast_Decl *d) {
+    const Decl_Fn *fn = &d->fn;
+    if (!d->is_exported)
+        put(g, "static ");
+    if (isCold(g, fn))
+        put(g, "L1_COLD ");
+    if (!emitType(g, fn->ret_type))
+        put(g, " ");
+    putName(g, fn->name);
+    put(g, "(");
+    if (fn->argc == 0)
+        put(g, "void");
+    for (size_t i = 0; i < fn->argc; i++) {
+        if (i > 0)
+            put(g, ", ");
+        emitDeclarator(g, fn->argv[i].type, fn->argv[i].is_const,
+                       fn->argv[i].name);
+    }
+    put(g, ")");
+}
+
+// whether C accepts `e` as a static initializer: arithmetic on literals, or
+// the address of a global at the top
+static bool isConstInit(const Ast_Expr *e, bool top) {
+    switch (e->type) {
+    case Expr_lit:
+        return true;
+    case Expr_binOp:
+        return isConstInit(e->binOp->left, false) &&
+               isConstInit(e->binOp->right, false);
+    case Expr_asType:
+        return isConstInit(e->asType->expr, false);
+    case Expr_ptr:
+        return top;
+    case Expr_fnCall:
+    case Expr_val:
+    case Expr_ident:
+        return false;
+    }
+    return false;
+}
+
+static bool isLateInit(const Ast_Decl *d) {
+    return d->type == Decl_var && d->var.init != NULL &&
+           !isConstInit(d->var.init, true);
+}
+
+// globals C can't initialize statically start out zero and are assigned by
+// emitLateInits(), so they lose their top-level const
+static void emitGlobal(CGen *g, const Ast_Decl *d) {
+    if (!d->is_exported)
+        put(g, "static ");
+    if (isLateInit(d)) {
+        const Ast_TypeExpr *t = d->var.type;
+        if (t != NULL && t->type == TypeExpr_const)
+            t = t->inner;
+        emitDeclarator(g, t, false, d->var.name);
+        put(g, ";\n");
+        return;
+    }
+    emitDeclarator(g, d->var.type, d->var.is_const, d->var.name);
+    if (d->var.init != NULL) {
+        put(g, " = ");
+        emitExpr(g, d->var.init, false);
+    }
+    put(g, ";\n");
+}
+
+// a constructor that runs the remaining initializers in declaration order,
+// before main
+static void emitLateInits(CGen *g, const Ast_Module *m) {
+    bool any = false;
+    for (size_t i = 0; i < m->declc && !any; i++)
+        any = isLateInit(&m->declv[i]);
+    if (!any)
+        return;
+
+    put(g, "\n"
+           "#ifdef __GNUC__\n"
+           "__attribute__((constructor)) static void l1init_globals(void) {\n");
+    for (size_t i = 0; i < m->declc; i++) {
+        const Ast_Decl *d = &m->declv[i];
+        if (!isLateInit(d))
+            continue;
+        indent(g, 1);
+        putName(g, d->var.name);
+        put(g, " = ");
+        emitExpr(g, d->var.init, false);
+        put(g, ";\n");
+    }
+    put(g, "}\n"
+           "#else\n"
+           "#error \"non-constant global initializers need a GNU C compiler\"\n"
+           "#endif\n");
+}
+
+bool CGen_emitModule(const Ast_Module *m, FILE *out, const CGen_Config *cfg) {
+    CGen g = {.out = out, .ok = true};
+    size_t sitec = 0;
+    if (cfg != NULL) {
+        g.profile = cfg->profile;
+        sitec = cfg->instrument ? countSites(m) : 0;
+        g.instrument = sitec > 0;
+    }
+    ByteBuf_init(&g.buf, FLUSH_AT);
+
+    put(&g, "// generated by lang1\n"
+            "#include <stdbool.h>\n"
+            "#include <stdint.h>\n");
+    if (g.instrument) {
+        put(&g, "#include <stdio.h>\n"
+                "#include <stdlib.h>\n"
+                "#include <string.h>\n");
+    }
+    if (g.profile != NULL) {
+        put(&g, "\n"
+                "#ifdef __GNUC__\n"
+                "#define L1_LIKELY(e) __builtin_expect(!!(e), 1)\n"
+                "#define L1_UNLIKELY(e) __builtin_expect(!!(e), 0)\n"
+                "#define L1_COLD __attribute__((cold))\n"
+                "#else\n"
+                "#define L1_LIKELY(e) (e)\n"
+                "#define L1_UNLIKELY(e) (e)\n"
+                "#define L1_COLD\n"
+                "#endif\n");
+    }
+
+    // prototypes first, so functions can be defined in any order
+    bool any = false;
+    for (size_t i = 0; i < m->declc; i++) {
+        if (m->declv[i].type != Decl_fn)
+            continue;
+        put(&g, any ? "" : "\n");
+        any = true;
+        emitSignature(&g, &m->declv[i]);
+        put(&g, ";\n");
+    }
+
+    any = false;
+    for (size_t i = 0; i < m->declc; i++) {
+        if (m->declv[i].type != Decl_var)
+            continue;
+        put(&g, any ? "" : "\n");
+        any = true;
+        emitGlobal(&g, &m->declv[i]);
+    }
+    emitLateInits(&g, m);
+
+    if (g.instrument) {
+        g.sites = malloc(sitec * sizeof(Site));
+        assert(g.sites != NULL);
+        put(&g, "\nstatic uint64_t l1prof_counts[");
+        putNum(&g, sitec);
+        put(&g, "];\n");
+    }
+
+    g.inFn = true;
+    for (size_t i = 0; i < m->declc; i++) {
+        const Ast_Decl *d = &m->declv[i];
+        if (d->type != Decl_fn)
+            continue;
+        assert(!d->fn.body_pending);
+        put(&g, "\n");
+        emitSignature(&g, d);
+        put(&g, " {\n");
+        if (g.instrument)
+            putCounterStmt(&g, Pgo_fnEntry, &d->fn.span, 1);
+        emitStmts(&g, d->fn.stmtc, d->fn.stmtv, 1);
+        put(&g, "}\n");
+    }
+
+    if (g.instrument) {
+        assert(g.sitec == sitec);
+        emitProfileWriter(&g);
+        free(g.sites);
+    }
+
+    flush(&g);
+    ByteBuf_free(&g.buf);
+    return g.ok && fflush(out) == 0;
+}
+
+#ifdef TESTING
+
+#include <unistd.h>
+
+// tests build their trees out of static pools, nothing is freed
+static Ast_Expr exprs[96];
+static size_t nexprs;
+static Expr_BinOp binOps[16];
+static size_t nbinOps;
+static Expr_Lit lits[32];
+static size_t nlits;
+
+static Ast_TypeExpr intType = {.type = TypeExpr_int};
+static Ast_TypeExpr boolType = {.type = TypeExpr_bool};
+static Ast_TypeExpr constInt = {.type = TypeExpr_const, .inner = &intType};
+static Ast_TypeExpr ptrConstInt = {.type = TypeExpr_ptr, .inner = &constInt};
+static Ast_TypeExpr ptrInt = {.type = TypeExpr_ptr, .inner = &intType};
+static Ast_TypeExpr constPtrInt = {.type = TypeExpr_const, .inner = &ptrInt};
+
+static Ast_Expr *newExpr(Ast_Expr e) {
+    assert(nexprs < sizeof exprs / sizeof *exprs);
+    exprs[nexprs] = e;
+    return &exprs[nexprs++];
+}
+
+static Ast_Expr *ident(char *name) {
+    return newExpr((Ast_Expr){.type = Expr_ident, .ident = name});
+}
+static Ast_Expr *lit(size_t n) {
+    lits[nlits] = (Expr_Lit){.type = Lit_int, .integer = n};
+    return newExpr((Ast_Expr){.type = Expr_lit, .lit = &lits[nlits++]});
+}
+static Ast_Expr *binOp(int type, Ast_Expr *l, Ast_Expr *r) {
+    binOps[nbinOps] = (Expr_BinOp){.type = type, .left = l, .right = r};
+    return newExpr((Ast_Expr){.type = Expr_binOp, .binOp = &binOps[nbinOps++]});
+}
+
+static char *emitted(const Ast_Module *m, const CGen_Config *cfg) {
+    static char buf[8192];
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(CGen_emitModule(m, f, cfg));
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof buf - 1, f);
+    buf[n] = 0;
+    fclose(f);
+    return buf;
+}
+
+void test_module() {
+    // const _limit: int = -3;
+    // var _cur: ptr const int = ptr _limit;
+    // export fn _clamp(_x: int, _p: const ptr int) int {
+    //     var _y: int = (_x * 2) + val _p;
+    //     if (_y < val _cur) { goto _low; }
+    //     return _y;
+    //     _low: return _helper(_y);
+    // }
+    // fn _helper(_v: int) bool { return _v == 0; }
+    Ast_Expr *y = ident("_y");
+
+    Decl_Var yVar = {
+        .name = "_y",
+        .type = &intType,
+        .init = binOp(BinOp_plus, binOp(BinOp_mul, ident("_x"), lit(2)),
+                      newExpr((Ast_Expr){.type = Expr_val,
+                                         .val = ident("_p")})),
+    };
+    Ast_Stmt gotoLow = {.type = Stmt_goto, .goto_stmt = "_low"};
+    Stmt_If guard = {
+        .cond = binOp(BinOp_lt, y,
+                      newExpr((Ast_Expr){.type = Expr_val,
+                                         .val = ident("_cur")})),
+        .stmtc = 1,
+        .stmtv = &gotoLow,
+    };
+    Expr_FnCall helperCall = {.head = ident("_helper"), .argc = 1, .argv = y};
+    Ast_Stmt lowReturn = {
+        .type = Stmt_return,
+        .return_stmt = newExpr(
+            (Ast_Expr){.type = Expr_fnCall, .fnCall = &helperCall}),
+    };
+    Stmt_Label low = {.name = "_low", .stmt = &lowReturn};
+    Ast_Stmt clampBody[] = {
+        {.type = Stmt_decl, .decl = &yVar},
+        {.type = Stmt_if, .if_stmt = &guard},
+        {.type = Stmt_return, .return_stmt = y},
+        {.type = Stmt_label, .label = &low},
+    };
+    Decl_Var clampArgs[] = {
+        {.name = "_x", .type = &intType},
+        {.name = "_p", .type = &constPtrInt},
+    };
+
+    Ast_Stmt helperBody = {
+        .type = Stmt_return,
+        .return_stmt = binOp(BinOp_eq, ident("_v"), lit(0)),
+    };
+    Decl_Var helperArgs[] = {{.name = "_v", .type = &intType}};
+
+    Ast_Decl decls[] = {
+        {.type = Decl_var,
+         .var = {.name = "_limit", .is_const = true, .type = &intType,
+                 .init = lit((size_t)-3)}},
+        {.type = Decl_var,
+         .var = {.name = "_cur", .type = &ptrConstInt,
+                 .init = newExpr((Ast_Expr){.type = Expr_ptr,
+                                            .ptr = "_limit"})}},
+        {.type = Decl_fn,
+         .is_exported = true,
+         .fn = {.name = "_clamp", .argc = 2, .argv = clampArgs,
+                .ret_type = &intType, .stmtc = 4, .stmtv = clampBody}},
+        {.type = Decl_fn,
+         .fn = {.name = "_helper", .argc = 1, .argv = helperArgs,
+                .ret_type = &boolType, .stmtc = 1, .stmtv = &helperBody}},
+    };
+    Ast_Module m = {.declc = 4, .declv = decls};
+
+    const char *want = "// generated by lang1\n"
+                       "#include <stdbool.h>\n"
+                       "#include <stdint.h>\n"
+                       "\n"
+                       "int64_t l1_clamp(int64_t l1_x, int64_t *const l1_p);\n"
+                       "static bool l1_helper(int64_t l1_v);\n"
+                       "\n"
+                       "static int64_t const l1_limit = (-INT64_C(2) - 1);\n"
+                       "static int64_t const *l1_cur = &l1_limit;\n"
+                       "\n"
+                       "int64_t l1_clamp(int64_t l1_x, int64_t *const l1_p) {\n"
+                       "    int64_t l1_y = (l1_x * INT64_C(2)) + *l1_p;\n"
+                       "    if (l1_y < *l1_cur) {\n"
+                       "        goto l1_low;\n"
+                       "    }\n"
+                       "    return l1_y;\n"
+                       "    l1_low:;\n"
+                       "    return l1_helper(l1_y);\n"
+                       "}\n"
+                       "\n"
+                       "static bool l1_helper(int64_t l1_v) {\n"
+                       "    return l1_v == INT64_C(0);\n"
+                       "}\n";
+    assert(!strcmp(emitted(&m, NULL), want));
+}
+
+void test_void() {
+    // export fn _nop() { return; }
+    Ast_Stmt body = {.type = Stmt_return};
+    Ast_Decl decl = {
+        .type = Decl_fn,
+        .is_exported = true,
+        .fn = {.name = "_nop", .stmtc = 1, .stmtv = &body},
+    };
+    Ast_Module m = {.declc = 1, .declv = &decl};
+
+    const char *want = "// generated by lang1\n"
+                       "#include <stdbool.h>\n"
+                       "#include <stdint.h>\n"
+                       "\n"
+                       "void l1_nop(void);\n"
+                       "\n"
+                       "void l1_nop(void) {\n"
+                       "    return;\n"
+                       "}\n";
+    assert(!strcmp(emitted(&m, NULL), want));
+}
+
+void test_late_init() {
+    // var _b: int = 1 + 2;
+    // var _a: int = _b;
+    // const _c: int = _f();
+    // fn _f() int { var _r: int = 2; return _r; }
+    Decl_Var r = {.name = "_r", .type = &intType, .in_register = true,
+                  .init = lit(2)};
+    Ast_Stmt fBody[] = {
+        {.type = Stmt_decl, .decl = &r},
+        {.type = Stmt_return, .return_stmt = ident("_r")},
+    };
+    Expr_FnCall fCall = {.head = ident("_f")};
+    Ast_Decl decls[] = {
+        {.type = Decl_var,
+         .var = {.name = "_b", .type = &intType,
+                 .init = binOp(BinOp_plus, lit(1), lit(2))}},
+        {.type = Decl_var,
+         .var = {.name = "_a", .type = &intType, .init = ident("_b")}},
+        {.type = Decl_var,
+         .var = {.name = "_c", .is_const = true, .type = &intType,
+                 .init = newExpr((Ast_Expr){.type = Expr_fnCall,
+                                            .fnCall = &fCall})}},
+        {.type = Decl_fn,
+         .fn = {.name = "_f", .ret_type = &intType, .stmtc = 2,
+                .stmtv = fBody}},
+    };
+    Ast_Module m = {.declc = 4, .declv = decls};
+
+    const char *want =
+        "// generated by lang1\n"
+        "#include <stdbool.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "static int64_t l1_f(void);\n"
+        "\n"
+        "static int64_t l1_b = INT64_C(1) + INT64_C(2);\n"
+        "static int64_t l1_a;\n"
+        "static int64_t l1_c;\n"
+        "\n"
+        "#ifdef __GNUC__\n"
+        "__attribute__((constructor)) static void l1init_globals(void) {\n"
+        "    l1_a = l1_b;\n"
+        "    l1_c = l1_f();\n"
+        "}\n"
+        "#else\n"
+        "#error \"non-constant global initializers need a GNU C compiler\"\n"
+        "#endif\n"
+        "\n"
+        "static int64_t l1_f(void) {\n"
+        "    int64_t l1_r = INT64_C(2);\n"
+        "    return l1_r;\n"
+        "}\n";
+    assert(!strcmp(emitted(&m, NULL), want));
+}
+
+void test_literal_width() {
+    // const _big: int = 1 << 40;
+    // export fn _prod() int { return 100000 * 100000; }
+    // export fn _shift() int { return _big; }
+    Ast_Stmt prodBody = {
+        .type = Stmt_return,
+        .return_stmt = binOp(BinOp_mul, lit(100000), lit(100000)),
+    };
+    Ast_Stmt shiftBody = {.type = Stmt_return, .return_stmt = ident("_big")};
+    Ast_Decl decls[] = {
+        {.type = Decl_var,
+         .var = {.name = "_big", .is_const = true, .type = &intType,
+                 .init = binOp(BinOp_lShift, lit(1), lit(40))}},
+        {.type = Decl_fn,
+         .is_exported = true,
+         .fn = {.name = "_prod", .ret_type = &intType, .stmtc = 1,
+                .stmtv = &prodBody}},
+        {.type = Decl_fn,
+         .is_exported = true,
+         .fn = {.name = "_shift", .ret_type = &intType, .stmtc = 1,
+                .stmtv = &shiftBody}},
+    };
+    Ast_Module m = {.declc = 3, .declv = decls};
+
+    // the C compiler has the last word, so build the output and run it
+    char src[64], exe[64], cmd[256];
+    snprintf(src, sizeof src, "/tmp/l1cgen%d.c", (int)getpid());
+    snprintf(exe, sizeof exe, "/tmp/l1cgen%d", (int)getpid());
+    FILE *f = fopen(src, "w");
+    assert(f != NULL);
+    assert(CGen_emitModule(&m, f, NULL));
+    fputs("\n"
+          "int main(void) {\n"
+          "    return !(l1_prod() == INT64_C(10000000000) &&\n"
+          "             l1_shift() == INT64_C(1099511627776));\n"
+          "}\n",
+          f);
+    assert(fclose(f) == 0);
+
+    const char *cc = getenv("CC");
+    snprintf(cmd, sizeof cmd, "%s --std=c11 -Wall -Werror %s -o %s",
+             cc != NULL ? cc : "cc", src, exe);
+    assert(system(cmd) == 0);
+    assert(system(exe) == 0);
+    remove(src);
+    remove(exe);
+}
+
+// export fn _f(_x: int) int { if (_x > 0) { return _g(_x); } return 0; }
+// fn _g(_y: int) int { return _y; }
+static Ast_Module *branchy() {
+    static Ast_Stmt taken, fBody[2], gBody;
+    static Stmt_If guard;
+    static Expr_FnCall gCall;
+    static Decl_Var fArgs[1], gArgs[1];
+    static Ast_Decl decls[2];
+    static Ast_Module m;
+
+    gCall = (Expr_FnCall){.head = ident("_g"), .argc = 1, .argv = ident("_x"),
+                          .span = {.docName = "b.l1", .start = {.row = 1}}};
+    taken = (Ast_Stmt){
+        .type = Stmt_return,
+        .return_stmt =
+            newExpr((Ast_Expr){.type = Expr_fnCall, .fnCall = &gCall}),
+    };
+    guard = (Stmt_If){.cond = binOp(BinOp_gt, ident("_x"), lit(0)),
+                      .stmtc = 1,
+                      .stmtv = &taken};
+    fBody[0] = (Ast_Stmt){.type = Stmt_if, .if_stmt = &guard,
+                          .span = {.docName = "b.l1", .start = {.row = 1}}};
+    fBody[1] = (Ast_Stmt){.type = Stmt_return, .return_stmt = lit(0)};
+    gBody = (Ast_Stmt){.type = Stmt_return, .return_stmt = ident("_y")};
+    fArgs[0] = (Decl_Var){.name = "_x", .type = &intType};
+    gArgs[0] = (Decl_Var){.name = "_y", .type = &intType};
+
+    decls[0] = (Ast_Decl){
+        .type = Decl_fn,
+        .is_exported = true,
+        .fn = {.name = "_f", .argc = 1, .argv = fArgs, .ret_type = &intType,
+               .stmtc = 2, .stmtv = fBody,
+               .span = {.docName = "b.l1", .start = {.row = 0}}},
+    };
+    decls[1] = (Ast_Decl){
+        .type = Decl_fn,
+        .fn = {.name = "_g", .argc = 1, .argv = gArgs, .ret_type = &intType,
+               .stmtc = 1, .stmtv = &gBody,
+               .span = {.docName = "b.l1", .start = {.row = 2}}},
+    };
+    m = (Ast_Module){.declc = 2, .declv = decls};
+    return &m;
+}
+
+void test_instrument() {
+    CGen_Config cfg = {.instrument = true};
+    char *out = emitted(branchy(), &cfg);
+
+    const char *body = "int64_t l1_f(int64_t l1_x) {\n"
+                       "    l1prof_counts[0]++;\n"
+                       "    l1prof_counts[1]++;\n"
+                       "    if (l1_x > INT64_C(0)) {\n"
+                       "        l1prof_counts[2]++;\n"
+                       "        return (l1prof_counts[3]++, l1_g(l1_x));\n"
+                       "    }\n"
+                       "    return INT64_C(0);\n"
+                       "}\n";
+    assert(strstr(out, "static uint64_t l1prof_counts[5];\n") != NULL);
+    assert(strstr(out, body) != NULL);
+    assert(strstr(out, "    {1, 0, 1, 0},\n"
+                       "    {2, 0, 1, 0},\n"
+                       "    {4, 0, 1, 0},\n") != NULL);
+    assert(strstr(out, "atexit(l1prof_write);") != NULL);
+}
+
+void test_profile() {
+    Pgo_Profile profile;
+    Pgo_init(&profile);
+    SrcSpan guard = {.docName = "b.l1", .start = {.row = 1}};
+    SrcSpan fSpan = {.docName = "b.l1", .start = {.row = 0}};
+    SrcSpan gSpan = {.docName = "b.l1", .start = {.row = 2}};
+    Pgo_add(&profile, Pgo_ifEntered, &guard, 100);
+    Pgo_add(&profile, Pgo_ifTaken, &guard, 3);
+    Pgo_add(&profile, Pgo_fnEntry, &fSpan, 100);
+    Pgo_add(&profile, Pgo_fnEntry, &gSpan, 0);
+
+    CGen_Config cfg = {.profile = &profile};
+    char *out = emitted(branchy(), &cfg);
+    assert(strstr(out, "    if (L1_UNLIKELY(l1_x > INT64_C(0))) {\n") != NULL);
+    assert(strstr(out, "static L1_COLD int64_t l1_g(int64_t l1_y);") != NULL);
+    assert(strstr(out, "\nint64_t l1_f(int64_t l1_x);") != NULL);
+    assert(strstr(out, "l1prof") == NULL);
+
+    // too few samples to hint
+    Pgo_free(&profile);
+    Pgo_init(&profile);
+    Pgo_add(&profile, Pgo_ifEntered, &guard, 4);
+    cfg.profile = &profile;
+    out = emitted(branchy(), &cfg);
+    assert(strstr(out, "    if (l1_x > INT64_C(0)) {\n") != NULL);
+    Pgo_free(&profile);
+}
+
+int main() {
+    printf("cgen module...");
+    test_module();
+    printf("OK!\n");
+    printf("cgen void...");
+    test_void();
+    printf("OK!\n");
+    printf("cgen late init...");
+    test_late_init();
+    printf("OK!\n");
+    printf("cgen literal width...");
+    test_literal_width();
+    printf("OK!\n");
+    printf("cgen instrument...");
+    test_instrument();
+    printf("OK!\n");
+    printf("cgen profile...");
+    test_profile();
+    printf("OK!\n");
+}
+
+#endif
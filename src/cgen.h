@@ -0,0 +1,34 @@
+// a backend that translates a checked module into a single self-contained
+// C11 translation unit, to be built with an optimizing C compiler.
+//
+// every lang1 identifier is prefixed with `l1`, since C reserves names that
+// start with an underscore: `export fn _add` is `l1_add` to C callers.
+// exported declarations get external linkage and everything else is static.
+// `int` is `int64_t`, `ptr T` is `T *` and `const T` is `T const`.
+//
+// globals whose initializers C can't evaluate statically, like calls or other
+// globals, are assigned by a constructor before main. that needs a GNU C
+// compiler, anything else stops at an `#error`.
+
+#pragma once
+
+#include "ast.h"
+#include "pgo.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct CGen_Config {
+    // count function entries, `if` edges, labels and calls. at exit the
+    // counts are appended to the file named by $LANG1_PROFILE, `lang1.prof`
+    // by default, for `Pgo_read()`. needs a GNU C compiler for the exit hook.
+    bool instrument;
+
+    // counts from an instrumented run. strongly biased branches get
+    // `__builtin_expect` hints so the compiler lays the hot path out
+    // straight, and functions that were never entered are marked cold.
+    const Pgo_Profile *profile;
+} CGen_Config;
+
+// writes `m` to `out`. `cfg` may be NULL for plain output. returns false on
+// a write error.
+bool CGen_emitModule(const Ast_Module *m, FILE *out, const CGen_Config *cfg);
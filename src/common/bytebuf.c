@@ -51,6 +51,7 @@ char *ByteBuf_string(ByteBuf *self) {
 void ByteBuf_copy(ByteBuf *dest, const ByteBuf *src) {
     ByteBuf_ensure(dest, src->capacity);
     memcpy(dest->data, src->data, src->len);
+    dest->len = src->len;
 }
 
 void ByteBuf_free(ByteBuf *self) {
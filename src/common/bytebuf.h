@@ -12,6 +12,8 @@ typedef struct {
 void ByteBuf_init(ByteBuf *self, size_t capacity);
 void ByteBuf_ensure(ByteBuf *self, size_t capacity);
 void ByteBuf_append(ByteBuf *self, char b);
+void ByteBuf_appendArr(ByteBuf *self, const char *array, size_t arrayLen);
+void ByteBuf_appendBuf(ByteBuf *self, const ByteBuf *other);
 void ByteBuf_copy(ByteBuf *dest, const ByteBuf *src);
 void ByteBuf_free(ByteBuf *self);
 char *ByteBuf_string(ByteBuf *self);
@@ -1,17 +1,18 @@
-
 #include "alloc.h"
 #include "../macros.h"
-#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 void *Mem_alloc(Alloc *alloc, size_t size) {
     return alloc->resize(alloc->context, NULL, size);
 }
 void *Mem_realloc(Alloc *alloc, void *addr, size_t newSize) {
-    return alloc->resize(alloc, addr, newSize);
+    return alloc->resize(alloc->context, addr, newSize);
+}
+void Mem_free(Alloc *alloc, void *addr) {
+    alloc->resize(alloc->context, addr, 0);
 }
-void Mem_free(Alloc *alloc, void *addr) { alloc->resize(alloc, addr, 0); }
 
 // singleton implementation for malloc/realloc/free
 void *malloc(size_t);
@@ -28,14 +29,10 @@ void *cResize(void *_, void *addr, size_t newSize) {
         free(addr);
 
     } else if (addr == NULL) {
-        void *newAddr = malloc(newSize);
-        if (errno == ENOMEM)
-            newAddr = NULL;
+        newAddr = malloc(newSize);
 
     } else {
         newAddr = realloc(addr, newSize);
-        if (errno == ENOMEM)
-            newAddr = NULL;
     }
 
     return newAddr;
@@ -51,8 +48,100 @@ Alloc mAlloc = {
 // char mem[100];
 // Mem_FixedBuf fb = {.data = mem, .capacity = sizeof mem};
 // Alloc fba = Alloc_fromFixedBuf(&fb);
-Alloc FixedBufAlloc(FixedBuf *buf) {
+#define FIXEDBUF_ALIGN 16
+
+static void *fbResize(void *context, void *addr, size_t newSize) {
+    FixedBuf *buf = context;
+    char *data = buf->data;
+
+    // only the most recent allocation can be freed or resized in place
+    if (addr != NULL && addr == buf->last_alloc) {
+        size_t start = (size_t)((char *)addr - data);
+        // a failed grow leaves the block as it was
+        if (buf->capacity - start < newSize)
+            return NULL;
+        buf->top = start + newSize;
+        buf->last_alloc = newSize == 0 ? NULL : addr;
+        return newSize == 0 ? NULL : addr;
+    }
+    if (newSize == 0)
+        return NULL;
+
+    size_t start =
+        (buf->top + FIXEDBUF_ALIGN - 1) & ~(size_t)(FIXEDBUF_ALIGN - 1);
+    if (start > buf->capacity || buf->capacity - start < newSize)
+        return NULL;
+
+    void *newAddr = data + start;
+    if (addr != NULL) {
+        // the old size is unknown, but it can be no larger than what is left
+        // between it and the new allocation
+        size_t oldMax = (size_t)(data + buf->top - (char *)addr);
+        memcpy(newAddr, addr, oldMax < newSize ? oldMax : newSize);
+    }
+    buf->top = start + newSize;
+    buf->last_alloc = newAddr;
+    return newAddr;
+}
+
+Alloc Alloc_fromFixedBuf(FixedBuf *buf) {
     buf->top = 0;
     buf->last_alloc = NULL;
+    return (Alloc){.context = buf, .resize = fbResize};
 }
-void *fbResize_(Mem_FixedBuf)
+
+#ifdef TESTING
+
+#include <stdio.h>
+
+void test_malloc() {
+    char *a = Mem_alloc(&mAlloc, 16);
+    assert(a != NULL);
+    memset(a, 'a', 16);
+
+    a = Mem_realloc(&mAlloc, a, 4096);
+    assert(a != NULL);
+    assert(a[15] == 'a');
+
+    Mem_free(&mAlloc, a);
+}
+
+void test_fixedbuf() {
+    char mem[100];
+    FixedBuf fb = {.data = mem, .capacity = sizeof mem};
+    Alloc fba = Alloc_fromFixedBuf(&fb);
+
+    char *a = Mem_alloc(&fba, 10);
+    char *b = Mem_alloc(&fba, 10);
+    assert(a == mem && b == mem + 16);
+
+    // the last allocation grows in place
+    assert(Mem_realloc(&fba, b, 40) == b);
+    assert(Mem_alloc(&fba, 64) == NULL);
+
+    // a grow that does not fit keeps the block allocated
+    assert(Mem_realloc(&fba, b, 200) == NULL);
+    assert(fb.top == 56 && fb.last_alloc == b);
+    Mem_free(&fba, b);
+    assert(fb.top == 16);
+
+    // and the next allocation lands after a block that failed to grow
+    b = Mem_alloc(&fba, 40);
+    assert(Mem_realloc(&fba, b, 200) == NULL);
+    char *c = Mem_alloc(&fba, 8);
+    assert(c == mem + 64);
+
+    Mem_free(&fba, c);
+    assert(fb.top == 64);
+}
+
+int main() {
+    printf("alloc malloc...");
+    test_malloc();
+    printf("OK!\n");
+    printf("alloc fixedbuf...");
+    test_fixedbuf();
+    printf("OK!\n");
+}
+
+#endif
@@ -0,0 +1,505 @@
+#define _DEFAULT_SOURCE
+
+#include "slab.h"
+#include "../macros.h"
+#include "alloc.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <threads.h>
+#include <unistd.h>
+
+#define NCLASSES 32
+#define LARGE_CLASS UINT32_MAX
+
+// slabs are mapped this many at a time
+#define SLAB_BATCH 16
+
+typedef struct Slab Slab;
+typedef struct ThreadCache ThreadCache;
+
+// lives at the start of every slab, and of every large allocation
+struct Slab {
+    ThreadCache *owner;
+
+    // links in the owner's `avail` or `full` list for this size class
+    Slab *prev;
+    Slab *next;
+    bool full;
+
+    uint32_t sizeClass;
+    uint32_t objSize;
+
+    // large allocations only
+    size_t mapLen;
+
+    // owner only
+    void *freeList;
+    char *bump;
+    char *end;
+
+    // objects freed by other threads
+    _Atomic(void *) remoteFree;
+    // set while the slab sits in the owner's `remoteSlabs`
+    atomic_bool queued;
+    Slab *remoteNext;
+};
+
+#define HEADER_SIZE ((sizeof(Slab) + 63) & ~(size_t)63)
+
+struct ThreadCache {
+    Slab *avail[NCLASSES];
+    Slab *full[NCLASSES];
+
+    // slabs with objects waiting in `remoteFree`, pushed by other threads
+    _Atomic(Slab *) remoteSlabs;
+
+    // the unused part of the last batch of mapped slabs
+    char *regionNext;
+    char *regionEnd;
+
+    ThreadCache *nextAbandoned;
+};
+
+// caches are never unmapped, since other threads may still be returning
+// objects to them. a cache left behind by an exiting thread is handed to the
+// next new thread instead.
+static _Thread_local ThreadCache *cache;
+static atomic_flag poolLock = ATOMIC_FLAG_INIT;
+static ThreadCache *abandoned;
+static tss_t exitKey;
+static once_flag exitKeyOnce = ONCE_FLAG_INIT;
+
+// size classes ////////////////////////////////////////////////////////////////
+
+// 16 byte steps up to 128, then four classes per doubling up to 8KiB
+static uint32_t classOf(size_t size) {
+    if (size <= 128)
+        return size == 0 ? 0 : (uint32_t)((size + 15) / 16 - 1);
+
+    unsigned p = (unsigned)(sizeof(unsigned long) * 8 - 1) -
+                 (unsigned)__builtin_clzl((unsigned long)(size - 1));
+    size_t step = (size_t)1 << (p - 2);
+    return 8 + (p - 7) * 4 + (uint32_t)((size - 1 - ((size_t)1 << p)) / step);
+}
+
+static uint32_t classSize(uint32_t cls) {
+    if (cls < 8)
+        return 16 * (cls + 1);
+
+    unsigned p = 7 + (cls - 8) / 4;
+    return (1u << p) + (1u << (p - 2)) * ((cls - 8) % 4 + 1);
+}
+
+// mapping /////////////////////////////////////////////////////////////////////
+
+static size_t pageSize(void) {
+    static size_t size;
+    if (size == 0)
+        size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// maps `len` bytes, aligned to `SLAB_SIZE`. `len` must be a multiple of the
+// page size.
+static void *mapAligned(size_t len) {
+    size_t mapLen = len + SLAB_SIZE;
+    char *p = mmap(NULL, mapLen, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    char *aligned =
+        (char *)(((uintptr_t)p + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (aligned > p)
+        munmap(p, (size_t)(aligned - p));
+    size_t tail = (size_t)(p + mapLen - (aligned + len));
+    if (tail > 0)
+        munmap(aligned + len, tail);
+    return aligned;
+}
+
+static Slab *slabOf(void *addr) {
+    return (Slab *)((uintptr_t)addr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+// thread caches ///////////////////////////////////////////////////////////////
+
+static void onThreadExit(void *c) {
+    while (atomic_flag_test_and_set_explicit(&poolLock, memory_order_acquire))
+        ;
+    ((ThreadCache *)c)->nextAbandoned = abandoned;
+    abandoned = c;
+    atomic_flag_clear_explicit(&poolLock, memory_order_release);
+}
+
+static void initExitKey(void) {
+    int ok = tss_create(&exitKey, onThreadExit);
+    assert(ok == thrd_success);
+}
+
+static ThreadCache *getCache(void) {
+    if (cache != NULL)
+        return cache;
+
+    call_once(&exitKeyOnce, initExitKey);
+
+    while (atomic_flag_test_and_set_explicit(&poolLock, memory_order_acquire))
+        ;
+    ThreadCache *c = abandoned;
+    if (c != NULL)
+        abandoned = c->nextAbandoned;
+    atomic_flag_clear_explicit(&poolLock, memory_order_release);
+
+    if (c == NULL) {
+        size_t len = (sizeof(ThreadCache) + pageSize() - 1) & ~(pageSize() - 1);
+        c = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+        if (c == MAP_FAILED)
+            return NULL;
+        atomic_init(&c->remoteSlabs, NULL);
+    }
+
+    tss_set(exitKey, c);
+    cache = c;
+    return c;
+}
+
+// slab lists //////////////////////////////////////////////////////////////////
+
+static void listRemove(Slab **list, Slab *s) {
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        *list = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+static void pushFront(Slab **list, Slab *s) {
+    s->prev = NULL;
+    s->next = *list;
+    if (*list != NULL)
+        (*list)->prev = s;
+    *list = s;
+}
+
+// moves a slab that has objects again from the full to the available list
+static void makeAvail(ThreadCache *c, Slab *s) {
+    if (!s->full)
+        return;
+    listRemove(&c->full[s->sizeClass], s);
+    s->full = false;
+    pushFront(&c->avail[s->sizeClass], s);
+}
+
+// small objects ///////////////////////////////////////////////////////////////
+
+static void *popObject(Slab *s) {
+    void *obj = s->freeList;
+    if (obj != NULL) {
+        s->freeList = *(void **)obj;
+        return obj;
+    }
+    if ((size_t)(s->end - s->bump) >= s->objSize) {
+        obj = s->bump;
+        s->bump += s->objSize;
+    }
+    return obj;
+}
+
+static void collectRemote(Slab *s) {
+    void *obj = atomic_exchange(&s->remoteFree, NULL);
+    while (obj != NULL) {
+        void *next = *(void **)obj;
+        *(void **)obj = s->freeList;
+        s->freeList = obj;
+        obj = next;
+    }
+}
+
+// takes back everything other threads have freed into our slabs
+static void drainRemote(ThreadCache *c) {
+    Slab *s = atomic_exchange(&c->remoteSlabs, NULL);
+    while (s != NULL) {
+        // read the link before a remote thread can queue the slab again
+        Slab *next = s->remoteNext;
+        atomic_store(&s->queued, false);
+        collectRemote(s);
+        if (s->freeList != NULL)
+            makeAvail(c, s);
+        s = next;
+    }
+}
+
+static Slab *newSlab(ThreadCache *c, uint32_t cls) {
+    if (c->regionNext == c->regionEnd) {
+        char *region = mapAligned(SLAB_SIZE * SLAB_BATCH);
+        if (region == NULL)
+            return NULL;
+        c->regionNext = region;
+        c->regionEnd = region + SLAB_SIZE * SLAB_BATCH;
+    }
+
+    Slab *s = (Slab *)c->regionNext;
+    c->regionNext += SLAB_SIZE;
+
+    *s = (Slab){
+        .owner = c,
+        .sizeClass = cls,
+        .objSize = classSize(cls),
+        .bump = (char *)s + HEADER_SIZE,
+        .end = (char *)s + SLAB_SIZE,
+    };
+    atomic_init(&s->remoteFree, NULL);
+    atomic_init(&s->queued, false);
+    return s;
+}
+
+static void *allocSmall(ThreadCache *c, uint32_t cls) {
+    bool drained = false;
+    for (;;) {
+        Slab *s = c->avail[cls];
+        if (s == NULL) {
+            if (drained)
+                break;
+            drainRemote(c);
+            drained = true;
+            continue;
+        }
+
+        void *obj = popObject(s);
+        if (obj != NULL)
+            return obj;
+        collectRemote(s);
+        obj = popObject(s);
+        if (obj != NULL)
+            return obj;
+
+        // exhausted, park it until something is freed into it
+        listRemove(&c->avail[cls], s);
+        s->full = true;
+        pushFront(&c->full[cls], s);
+    }
+
+    Slab *s = newSlab(c, cls);
+    if (s == NULL)
+        return NULL;
+    pushFront(&c->avail[cls], s);
+    return popObject(s);
+}
+
+static void freeRemote(Slab *s, void *obj) {
+    void *head = atomic_load(&s->remoteFree);
+    do {
+        *(void **)obj = head;
+    } while (!atomic_compare_exchange_weak(&s->remoteFree, &head, obj));
+
+    // tell the owner about the slab, unless it has been told already
+    if (!atomic_exchange(&s->queued, true)) {
+        ThreadCache *owner = s->owner;
+        Slab *top = atomic_load(&owner->remoteSlabs);
+        do {
+            s->remoteNext = top;
+        } while (!atomic_compare_exchange_weak(&owner->remoteSlabs, &top, s));
+    }
+}
+
+// allocator ///////////////////////////////////////////////////////////////////
+
+static void *slabMalloc(size_t size) {
+    if (size > SLAB_MAX_SMALL) {
+        size_t len = (HEADER_SIZE + size + pageSize() - 1) & ~(pageSize() - 1);
+        Slab *s = mapAligned(len);
+        if (s == NULL)
+            return NULL;
+        *s = (Slab){.sizeClass = LARGE_CLASS, .mapLen = len};
+        return (char *)s + HEADER_SIZE;
+    }
+
+    ThreadCache *c = getCache();
+    if (c == NULL)
+        return NULL;
+    return allocSmall(c, classOf(size));
+}
+
+static void slabFree(void *addr) {
+    Slab *s = slabOf(addr);
+    if (s->sizeClass == LARGE_CLASS) {
+        munmap(s, s->mapLen);
+        return;
+    }
+
+    if (s->owner != cache) {
+        freeRemote(s, addr);
+        return;
+    }
+
+    *(void **)addr = s->freeList;
+    s->freeList = addr;
+    makeAvail(cache, s);
+}
+
+size_t Slab_usableSize(void *addr) {
+    Slab *s = slabOf(addr);
+    if (s->sizeClass == LARGE_CLASS)
+        return s->mapLen - HEADER_SIZE;
+    return s->objSize;
+}
+
+static void *slabResize(void *_, void *addr, size_t newSize) {
+    (void)_;
+
+    if (newSize == 0) {
+        if (addr != NULL)
+            slabFree(addr);
+        return NULL;
+    }
+    if (addr == NULL)
+        return slabMalloc(newSize);
+
+    size_t oldSize = Slab_usableSize(addr);
+    if (newSize <= oldSize)
+        return addr;
+
+    void *newAddr = slabMalloc(newSize);
+    if (newAddr == NULL)
+        return NULL;
+    memcpy(newAddr, addr, oldSize);
+    slabFree(addr);
+    return newAddr;
+}
+
+Alloc slabAlloc = {
+    .context = NULL,
+    .resize = slabResize,
+};
+
+#ifdef TESTING
+
+#include <stdio.h>
+
+#define TEST_OBJECTS 20000
+
+void test_classes() {
+    for (size_t size = 1; size <= SLAB_MAX_SMALL; size++) {
+        uint32_t cls = classOf(size);
+        assert(cls < NCLASSES);
+        assert(classSize(cls) >= size);
+        assert(cls == 0 || classSize(cls - 1) < size);
+    }
+    assert(classSize(NCLASSES - 1) == SLAB_MAX_SMALL);
+}
+
+void test_basic() {
+    char *a = Mem_alloc(&slabAlloc, 24);
+    char *b = Mem_alloc(&slabAlloc, 24);
+    assert(a != NULL && b != NULL);
+    // no per-object header
+    assert(b - a == 32);
+    assert(Slab_usableSize(a) == 32);
+
+    memset(a, 'a', 24);
+    a = Mem_realloc(&slabAlloc, a, 1000);
+    assert(Slab_usableSize(a) >= 1000);
+    for (int i = 0; i < 24; i++) {
+        assert(a[i] == 'a');
+    }
+
+    char *big = Mem_alloc(&slabAlloc, 1 << 20);
+    assert(big != NULL);
+    assert(Slab_usableSize(big) >= 1 << 20);
+    memset(big, 'b', 1 << 20);
+    memcpy(big, a, 24);
+    big = Mem_realloc(&slabAlloc, big, 3 << 20);
+    assert(big[0] == 'a' && big[(1 << 20) - 1] == 'b');
+
+    Mem_free(&slabAlloc, big);
+    Mem_free(&slabAlloc, a);
+    Mem_free(&slabAlloc, b);
+
+    // freed objects are reused first
+    char *c = Mem_alloc(&slabAlloc, 20);
+    assert(c == b);
+    Mem_free(&slabAlloc, c);
+}
+
+static void *objects[TEST_OBJECTS];
+
+static int freeAll(void *_) {
+    (void)_;
+    for (int i = 0; i < TEST_OBJECTS; i++)
+        Mem_free(&slabAlloc, objects[i]);
+    return 0;
+}
+
+static int allocAll(void *_) {
+    (void)_;
+    for (int i = 0; i < TEST_OBJECTS; i++) {
+        objects[i] = Mem_alloc(&slabAlloc, 48);
+        assert(objects[i] != NULL);
+        memset(objects[i], i & 0xff, 48);
+    }
+    return 0;
+}
+
+void test_remote_free() {
+    allocAll(NULL);
+
+    thrd_t thread;
+    assert(thrd_create(&thread, freeAll, NULL) == thrd_success);
+    thrd_join(thread, NULL);
+
+    // everything freed on the other thread comes back to this one
+    char *lo = (char *)slabOf(objects[0]), *hi = lo;
+    for (int i = 0; i < TEST_OBJECTS; i++) {
+        char *s = (char *)slabOf(objects[i]);
+        lo = s < lo ? s : lo;
+        hi = s > hi ? s : hi;
+    }
+    for (int i = 0; i < TEST_OBJECTS; i++) {
+        char *obj = Mem_alloc(&slabAlloc, 48);
+        assert((char *)slabOf(obj) >= lo && (char *)slabOf(obj) <= hi);
+        objects[i] = obj;
+    }
+    for (int i = 0; i < TEST_OBJECTS; i++)
+        Mem_free(&slabAlloc, objects[i]);
+}
+
+void test_thread_exit() {
+    // objects outlive the thread that allocated them
+    thrd_t thread;
+    assert(thrd_create(&thread, allocAll, NULL) == thrd_success);
+    thrd_join(thread, NULL);
+
+    for (int i = 0; i < TEST_OBJECTS; i++) {
+        assert(((unsigned char *)objects[i])[47] == (i & 0xff));
+    }
+    freeAll(NULL);
+
+    // the next thread adopts the abandoned cache, and with it the objects we
+    // just returned
+    assert(thrd_create(&thread, allocAll, NULL) == thrd_success);
+    thrd_join(thread, NULL);
+    freeAll(NULL);
+}
+
+int main() {
+    printf("slab size classes...");
+    test_classes();
+    printf("OK!\n");
+    printf("slab basic...");
+    test_basic();
+    printf("OK!\n");
+    printf("slab remote free...");
+    test_remote_free();
+    printf("OK!\n");
+    printf("slab thread exit...");
+    test_thread_exit();
+    printf("OK!\n");
+}
+
+#endif
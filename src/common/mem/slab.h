@@ -0,0 +1,22 @@
+// a size-class slab allocator with thread local caches. a drop-in replacement
+// for `mAlloc` that can be shared by any number of threads.
+//
+// small objects come out of 64KiB slabs owned by one thread. the size of an
+// object is found from the header of the slab it lives in, so objects carry
+// no header of their own. objects freed by a thread other than the owner are
+// handed back through a lock-free queue on the slab. anything over
+// `SLAB_MAX_SMALL` is mapped on its own.
+
+#pragma once
+
+#include "alloc.h"
+#include <stddef.h>
+
+#define SLAB_SIZE ((size_t)64 * 1024)
+#define SLAB_MAX_SMALL ((size_t)8 * 1024)
+
+// global implementation for the slab allocator
+extern Alloc slabAlloc;
+
+// the usable size of an allocation made by `slabAlloc`.
+size_t Slab_usableSize(void *addr);
@@ -7,6 +7,7 @@ typedef struct SrcPosn {
     size_t row;
 } SrcPosn;
 
+// rows and columns count from 0, and `end` is one past the last character
 typedef struct SrcSpan {
     char *docName;
     SrcPosn start;
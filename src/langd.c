@@ -0,0 +1,74 @@
+// command line front end for the compile server, see `server.h`.
+//
+//   langd serve <socket>
+//   langd compile <socket> <file>...
+
+#define _XOPEN_SOURCE 700
+
+#include "common/bytebuf.h"
+#include "server.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int usage(const char *self) {
+    fprintf(stderr,
+            "usage:\n"
+            "  %s serve <socket>\n"
+            "  %s compile <socket> <file>...\n",
+            self, self);
+    return 2;
+}
+
+static int serve(const char *sockPath) {
+    Server s;
+    Server_init(&s);
+    bool ok = Server_listen(&s, sockPath);
+    Server_cleanup(&s);
+
+    if (!ok) {
+        fprintf(stderr, "langd: could not listen on '%s'\n", sockPath);
+        return 1;
+    }
+    return 0;
+}
+
+static int compile(const char *sockPath, int argc, char **argv) {
+    ByteBuf reply;
+    ByteBuf_init(&reply, 256);
+
+    int status = 0;
+    for (int i = 0; i < argc; i++) {
+        // the server may be running in another directory
+        char path[PATH_MAX];
+        if (realpath(argv[i], path) == NULL) {
+            fprintf(stderr, "langd: no such file '%s'\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        char request[PATH_MAX + 16];
+        snprintf(request, sizeof request, "compile %s", path);
+        if (!Server_request(sockPath, request, &reply)) {
+            fprintf(stderr, "langd: no server at '%s'\n", sockPath);
+            status = 1;
+            break;
+        }
+
+        fwrite(reply.data, 1, reply.len, stdout);
+        if (reply.len < 3 || memcmp(reply.data, "ok ", 3))
+            status = 1;
+    }
+
+    ByteBuf_free(&reply);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "serve"))
+        return serve(argv[2]);
+    if (argc >= 4 && !strcmp(argv[1], "compile"))
+        return compile(argv[2], argc - 3, argv + 3);
+    return usage(argv[0]);
+}
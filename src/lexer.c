@@ -59,6 +59,7 @@ void Lexer_cleanup(Lexer *lex) {
 }
 
 static bool advance(Lexer *lex) {
+    int prev = lex->curChar;
     if (lex->consumed == 0) {
         lex->curChar = lex->readChar(lex->context);
     } else
@@ -72,15 +73,14 @@ static bool advance(Lexer *lex) {
     } else
         lex->consumed += 1;
 
-    if (lex->curChar == '\n') {
+    // the first character stays at 0:0. a newline ends its own line, so
+    // only the character after it starts the next one.
+    if (lex->consumed > 1 && prev == '\n') {
         lex->curPosn.col = 0;
         lex->curPosn.row += 1;
-    }
-
-    // only increment the column after the first
-    // character is consumed
-    if (lex->consumed > 1)
+    } else if (lex->consumed > 1) {
         lex->curPosn.col += 1;
+    }
 
     return true;
 }
@@ -128,6 +128,7 @@ advance:
     // we undo this if execution falls through to the
     // end of the function, or fails mid-token
     lex->produced += 1;
+    lex->startOffset = lex->consumed - 1;
     lex->startPosn.col = lex->curPosn.col;
     lex->startPosn.row = lex->curPosn.row;
     ByteBuf_append(&lex->valueBuf, (char)lex->curChar);
@@ -241,6 +242,7 @@ void test_basic() {
     assert(token == Token_ident);
     assert(lex.tokenValue != NULL);
     assert(!strcmp(lex.tokenValue, "there"));
+    assert(lex.startOffset == strlen("hello\n "));
 
     token = Lexer_next(&lex);
 
@@ -257,6 +259,8 @@ void test_basic() {
     assert(Lexer_next(&lex) == Token_true);
     assert(Lexer_next(&lex) == Token_rParen);
     assert(Lexer_next(&lex) == Token_ltEq);
+    assert(lex.startOffset == strlen("if (true) "));
+    assert(lex.consumed - lex.startOffset == 2);
 
     Lexer_cleanup(&lex);
 }
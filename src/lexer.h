@@ -87,6 +87,10 @@ typedef struct Lexer {
     // the running total tokens that the lexer has produced.
     size_t produced;
 
+    // the offset into the input of the first character of the last token.
+    // the token spans up to `consumed`.
+    size_t startOffset;
+
     ByteBuf valueBuf;
 
     // an optional string of data associated with the last token the lexer
@@ -128,7 +132,7 @@ typedef struct TestLexer_ReadCtx {
     size_t offset;
 } TestLexer_ReadCtx;
 
-static int TestLexer_readChar(TestLexer_ReadCtx *state) {
+static inline int TestLexer_readChar(TestLexer_ReadCtx *state) {
     if (state->offset < state->len) {
         char ch = state->data[state->offset];
         state->offset += 1;
@@ -0,0 +1,567 @@
+#define _DEFAULT_SOURCE
+
+#include "loader.h"
+#include "common/macros.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <threads.h>
+#include <unistd.h>
+
+#define DEFAULT_DEPTH 64
+#define MAX_THREADS 64
+
+// largest single read queued on the ring. an SQE length is 32 bits, and
+// bigger files are read in several goes. tests use a tiny limit so that
+// every file takes a few.
+#ifdef TESTING
+#define MAX_READ ((size_t)64)
+#else
+#define MAX_READ ((size_t)1 << 30)
+#endif
+
+// loaded files waiting for a worker ///////////////////////////////////////////
+
+typedef struct Queue {
+    mtx_t lock;
+    cnd_t ready;
+
+    // every file passes through exactly once, so this never wraps
+    SrcFile **items;
+    size_t head;
+    size_t tail;
+    bool closed;
+} Queue;
+
+static void push(Queue *q, SrcFile *file) {
+    mtx_lock(&q->lock);
+    q->items[q->tail++] = file;
+    cnd_signal(&q->ready);
+    mtx_unlock(&q->lock);
+}
+
+// NULL once the queue is closed and empty
+static SrcFile *pop(Queue *q) {
+    mtx_lock(&q->lock);
+    while (q->head == q->tail && !q->closed)
+        cnd_wait(&q->ready, &q->lock);
+    SrcFile *file = q->head < q->tail ? q->items[q->head++] : NULL;
+    mtx_unlock(&q->lock);
+    return file;
+}
+
+static void closeQueue(Queue *q) {
+    mtx_lock(&q->lock);
+    q->closed = true;
+    cnd_broadcast(&q->ready);
+    mtx_unlock(&q->lock);
+}
+
+typedef struct Run {
+    Loader *loader;
+    SrcFile *files;
+    size_t count;
+    Queue queue;
+
+    // next file for the fallback readers
+    atomic_size_t next;
+} Run;
+
+static int work(void *arg) {
+    Run *run = arg;
+    SrcFile *file;
+    while ((file = pop(&run->queue)) != NULL)
+        run->loader->onLoad(run->loader->context, file);
+    return 0;
+}
+
+// opening /////////////////////////////////////////////////////////////////////
+
+// opens the file and allocates room for its contents. returns false if the
+// file is already finished, either failed or empty.
+static bool openFile(SrcFile *file) {
+    file->data = NULL;
+    file->len = 0;
+    file->done = 0;
+    file->err = 0;
+    file->inflight = false;
+
+    file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) {
+        file->err = errno;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(file->fd, &st) < 0) {
+        file->err = errno;
+    } else {
+        file->len = (size_t)st.st_size;
+        // one extra byte so an empty file still gets a buffer
+        file->data = malloc(file->len + 1);
+        if (file->data == NULL)
+            file->err = ENOMEM;
+    }
+
+    if (file->err != 0 || file->len == 0) {
+        close(file->fd);
+        file->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void finish(SrcFile *file, int err) {
+    close(file->fd);
+    file->fd = -1;
+    file->err = err;
+    if (err != 0) {
+        free(file->data);
+        file->data = NULL;
+        file->len = 0;
+    } else {
+        // the file may have shrunk since it was opened
+        file->len = file->done;
+    }
+}
+
+// blocking fallback ///////////////////////////////////////////////////////////
+
+static int readFiles(void *arg) {
+    Run *run = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&run->next, 1);
+        if (i >= run->count)
+            return 0;
+
+        SrcFile *file = &run->files[i];
+        if (openFile(file)) {
+            int err = 0;
+            while (file->done < file->len) {
+                ssize_t n = pread(file->fd, file->data + file->done,
+                                  file->len - file->done, (off_t)file->done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0) {
+                    err = n < 0 ? errno : 0;
+                    break;
+                }
+                file->done += (size_t)n;
+            }
+            finish(file, err);
+        }
+        push(&run->queue, file);
+    }
+}
+
+static void loadBlocking(Run *run, unsigned depth) {
+    thrd_t readers[MAX_THREADS];
+    unsigned n = depth < MAX_THREADS ? depth : MAX_THREADS;
+    if (n > run->count)
+        n = (unsigned)run->count;
+
+    unsigned started = 0;
+    while (started < n &&
+           thrd_create(&readers[started], readFiles, run) == thrd_success)
+        started++;
+
+    // whatever is left over is read on this thread
+    readFiles(run);
+    for (unsigned i = 0; i < started; i++)
+        thrd_join(readers[i], NULL);
+}
+
+// io_uring ////////////////////////////////////////////////////////////////////
+
+typedef struct Ring {
+    int fd;
+
+    void *sqMap;
+    size_t sqMapLen;
+    void *cqMap;
+    size_t cqMapLen;
+    struct io_uring_sqe *sqes;
+    size_t sqesLen;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    // queued since the last `io_uring_enter()`
+    unsigned pending;
+} Ring;
+
+// whether the kernel has `IORING_OP_READ`, which came a few releases after
+// io_uring itself. kernels without the probe do not have it either.
+static bool canRead(int fd) {
+    unsigned ops = IORING_OP_READ + 1;
+    struct io_uring_probe *probe =
+        calloc(1, sizeof *probe + ops * sizeof(struct io_uring_probe_op));
+    if (probe == NULL)
+        return false;
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                      probe, ops) >= 0 &&
+              probe->last_op >= IORING_OP_READ &&
+              (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static bool ringInit(Ring *r, unsigned entries) {
+    struct io_uring_params p = {0};
+    *r = (Ring){.fd = (int)syscall(__NR_io_uring_setup, entries, &p)};
+    if (r->fd < 0)
+        return false;
+
+    r->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cqMapLen > r->sqMapLen)
+        r->sqMapLen = r->cqMapLen;
+
+    r->sqMap = mmap(NULL, r->sqMapLen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cqMap = single ? r->sqMap
+                      : mmap(NULL, r->cqMapLen, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, r->fd,
+                             IORING_OFF_CQ_RING);
+    r->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesLen, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (single)
+        r->cqMapLen = 0;
+
+    if (r->sqMap == MAP_FAILED || r->cqMap == MAP_FAILED ||
+        r->sqes == MAP_FAILED || !canRead(r->fd)) {
+        if (r->sqMap != MAP_FAILED)
+            munmap(r->sqMap, r->sqMapLen);
+        if (!single && r->cqMap != MAP_FAILED)
+            munmap(r->cqMap, r->cqMapLen);
+        if (r->sqes != MAP_FAILED)
+            munmap(r->sqes, r->sqesLen);
+        close(r->fd);
+        return false;
+    }
+
+    char *sq = r->sqMap;
+    r->sqHead = (unsigned *)(sq + p.sq_off.head);
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)(sq + p.sq_off.array);
+
+    char *cq = r->cqMap;
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void ringCleanup(Ring *r) {
+    munmap(r->sqes, r->sqesLen);
+    if (r->cqMapLen > 0)
+        munmap(r->cqMap, r->cqMapLen);
+    munmap(r->sqMap, r->sqMapLen);
+    close(r->fd);
+}
+
+// queues a read of the rest of `file`. the caller keeps the number of reads
+// in flight below the ring size, so there is always a free entry.
+static void queueRead(Ring *r, SrcFile *file) {
+    unsigned tail = *r->sqTail;
+    unsigned i = tail & r->sqMask;
+    size_t len = file->len - file->done;
+    if (len > MAX_READ)
+        len = MAX_READ;
+
+    r->sqes[i] = (struct io_uring_sqe){
+        .opcode = IORING_OP_READ,
+        .fd = file->fd,
+        .addr = (uint64_t)(uintptr_t)(file->data + file->done),
+        .len = (uint32_t)len,
+        .off = file->done,
+        .user_data = (uint64_t)(uintptr_t)file,
+    };
+    r->sqArray[i] = i;
+    file->inflight = true;
+
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->pending += 1;
+}
+
+// submits pending reads and waits for at least one completion
+static bool ringEnter(Ring *r) {
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, r->fd, r->pending, 1,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0) {
+            r->pending -= (unsigned)n;
+            return true;
+        }
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+// waits out the `inflight` reads queued on a ring that has stopped working,
+// so their buffers can be freed. reads the kernel never took off the
+// submission queue are dropped, and if waiting fails the rest stay marked.
+static void drain(Ring *r, size_t inflight) {
+    unsigned sqHead = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    for (unsigned i = sqHead; i != *r->sqTail; i++) {
+        const struct io_uring_sqe *sqe = &r->sqes[r->sqArray[i & r->sqMask]];
+        ((SrcFile *)(uintptr_t)sqe->user_data)->inflight = false;
+        inflight--;
+    }
+
+    for (;;) {
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & r->cqMask];
+            ((SrcFile *)(uintptr_t)cqe->user_data)->inflight = false;
+            inflight--;
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+        if (inflight == 0)
+            return;
+
+        long n = syscall(__NR_io_uring_enter, r->fd, 0, 1,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0 && errno != EINTR)
+            return;
+    }
+}
+
+// returns false if the ring could not be used at all, in which case nothing
+// has been submitted and the caller should fall back.
+static bool loadUring(Run *run, unsigned depth) {
+    Ring r;
+    if (!ringInit(&r, depth))
+        return false;
+
+    size_t next = 0;
+    size_t inflight = 0;
+    bool broken = false;
+
+    while ((next < run->count || inflight > 0) && !broken) {
+        while (inflight < depth && next < run->count) {
+            SrcFile *file = &run->files[next++];
+            if (openFile(file)) {
+                queueRead(&r, file);
+                inflight++;
+            } else {
+                push(&run->queue, file);
+            }
+        }
+
+        // every file left failed to open
+        if (inflight == 0)
+            continue;
+
+        if (!ringEnter(&r)) {
+            broken = true;
+            break;
+        }
+
+        unsigned head = *r.cqHead;
+        unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r.cqes[head & r.cqMask];
+            SrcFile *file = (SrcFile *)(uintptr_t)cqe->user_data;
+            file->inflight = false;
+
+            if (cqe->res > 0) {
+                file->done += (size_t)cqe->res;
+                if (file->done < file->len) {
+                    // short read, go again for the rest
+                    queueRead(&r, file);
+                    continue;
+                }
+            }
+
+            finish(file, cqe->res < 0 ? -cqe->res : 0);
+            push(&run->queue, file);
+            inflight--;
+        }
+        __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if (broken)
+        drain(&r, inflight);
+    ringCleanup(&r);
+
+    if (broken) {
+        // the ring fell over mid-way, fail whatever it still had and read
+        // the rest the slow way
+        for (size_t i = 0; i < next; i++) {
+            SrcFile *file = &run->files[i];
+            if (file->fd < 0)
+                continue;
+            // the kernel may still write into a buffer it never gave back,
+            // so it is leaked rather than freed
+            if (file->inflight)
+                file->data = NULL;
+            finish(file, EIO);
+            push(&run->queue, file);
+        }
+        atomic_store(&run->next, next);
+        loadBlocking(run, depth);
+    }
+    return true;
+}
+
+// driver //////////////////////////////////////////////////////////////////////
+
+bool Loader_run(Loader *loader, SrcFile *files, size_t count) {
+    unsigned workers = loader->workers;
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (unsigned)cores : 1;
+    }
+    if (workers > MAX_THREADS)
+        workers = MAX_THREADS;
+    unsigned depth = loader->depth != 0 ? loader->depth : DEFAULT_DEPTH;
+
+    for (size_t i = 0; i < count; i++)
+        files[i].fd = -1;
+
+    Run run = {
+        .loader = loader,
+        .files = files,
+        .count = count,
+        .queue = {.items = malloc((count + 1) * sizeof(SrcFile *))},
+    };
+    atomic_init(&run.next, 0);
+    if (run.queue.items == NULL)
+        return false;
+    mtx_init(&run.queue.lock, mtx_plain);
+    cnd_init(&run.queue.ready);
+
+    thrd_t threads[MAX_THREADS];
+    unsigned started = 0;
+    while (started < workers &&
+           thrd_create(&threads[started], work, &run) == thrd_success)
+        started++;
+
+    bool ok = started > 0;
+    if (ok) {
+        loader->usedUring = !loader->noUring && loadUring(&run, depth);
+        if (!loader->usedUring)
+            loadBlocking(&run, depth);
+    }
+
+    closeQueue(&run.queue);
+    for (unsigned i = 0; i < started; i++)
+        thrd_join(threads[i], NULL);
+
+    cnd_destroy(&run.queue.ready);
+    mtx_destroy(&run.queue.lock);
+    free(run.queue.items);
+    return ok;
+}
+
+#ifdef TESTING
+
+#include "tokbuf.h"
+#include <stdio.h>
+
+#define TEST_FILES 200
+
+typedef struct Totals {
+    atomic_size_t files;
+    atomic_size_t tokens;
+    atomic_size_t failed;
+} Totals;
+
+static void lexFile(void *context, SrcFile *file) {
+    Totals *totals = context;
+    atomic_fetch_add(&totals->files, 1);
+    if (file->err != 0) {
+        atomic_fetch_add(&totals->failed, 1);
+        return;
+    }
+
+    TokBuf toks;
+    TokBuf_init(&toks);
+    assert(TokBuf_lex(&toks, file->data, file->len, 1));
+    atomic_fetch_add(&totals->tokens, toks.len);
+    TokBuf_free(&toks);
+}
+
+static char paths[TEST_FILES + 1][64];
+
+static void writeFiles(void) {
+    for (int i = 0; i < TEST_FILES; i++) {
+        snprintf(paths[i], sizeof paths[i], "/tmp/lang1_loader_%d_%d.l1",
+                 (int)getpid(), i);
+        FILE *f = fopen(paths[i], "wb");
+        assert(f != NULL);
+        // file i holds i + 1 copies of a seven token declaration
+        for (int j = 0; j <= i; j++)
+            fputs("var _x: int = 3;\n", f);
+        fclose(f);
+    }
+    snprintf(paths[TEST_FILES], sizeof paths[TEST_FILES],
+             "/tmp/lang1_loader_%d_missing.l1", (int)getpid());
+}
+
+static void loadAll(bool noUring) {
+    SrcFile files[TEST_FILES + 1];
+    for (int i = 0; i <= TEST_FILES; i++)
+        files[i] = (SrcFile){.path = paths[i]};
+
+    Totals totals;
+    atomic_init(&totals.files, 0);
+    atomic_init(&totals.tokens, 0);
+    atomic_init(&totals.failed, 0);
+
+    Loader loader = {
+        .workers = 4,
+        .depth = 16,
+        .noUring = noUring,
+        .onLoad = lexFile,
+        .context = &totals,
+    };
+    assert(Loader_run(&loader, files, TEST_FILES + 1));
+    assert(!noUring || !loader.usedUring);
+
+    assert(atomic_load(&totals.files) == TEST_FILES + 1);
+    assert(atomic_load(&totals.failed) == 1);
+    assert(atomic_load(&totals.tokens) ==
+           7 * (size_t)TEST_FILES * (TEST_FILES + 1) / 2);
+    assert(files[TEST_FILES].err == ENOENT);
+
+    for (int i = 0; i <= TEST_FILES; i++)
+        free(files[i].data);
+
+    printf("(%s) ", loader.usedUring ? "io_uring" : "pread");
+}
+
+int main() {
+    writeFiles();
+
+    printf("loader default...");
+    loadAll(false);
+    printf("OK!\n");
+    printf("loader fallback...");
+    loadAll(true);
+    printf("OK!\n");
+
+    for (int i = 0; i < TEST_FILES; i++)
+        unlink(paths[i]);
+}
+
+#endif
@@ -0,0 +1,49 @@
+// batched source loading. reads many files at once, through io_uring where
+// the kernel allows it and a pool of blocking readers otherwise, and hands
+// each file to a worker thread as soon as its contents are in memory.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct SrcFile {
+    const char *path;
+
+    // the whole file, owned by the caller once loaded. NULL on failure.
+    char *data;
+    size_t len;
+
+    // errno value if the file could not be read, 0 otherwise
+    int err;
+
+    // loader bookkeeping
+    int fd;
+    size_t done;
+    // a read into `data` was handed to the kernel and has not completed
+    bool inflight;
+} SrcFile;
+
+typedef struct Loader {
+    // threads running `onLoad`, 0 for one per online core
+    unsigned workers;
+
+    // reads in flight at once, 0 for a default
+    unsigned depth;
+
+    // always use the blocking fallback, even where io_uring works
+    bool noUring;
+
+    // called once per file from a worker thread, in completion order. the
+    // file may have failed to load, see `SrcFile.err`.
+    void (*onLoad)(void *context, SrcFile *file);
+    void *context;
+
+    // set by `Loader_run()`
+    bool usedUring;
+} Loader;
+
+// loads `files[0..count)`, which only need `path` set, and returns after
+// every one of them has been passed to `onLoad`. returns false if no threads
+// could be started.
+bool Loader_run(Loader *loader, SrcFile *files, size_t count);
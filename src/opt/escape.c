@@ -0,0 +1,729 @@
+#include "escape.h"
+#include "../ast.h"
+#include "../common/macros.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Local Local;
+
+struct Local {
+    Decl_Var *decl;
+
+    // `ptr` has been applied to it somewhere
+    bool addrTaken;
+    // another local or a global has the same name, or the name is used
+    // where the local is out of scope, so uses by name cannot be told apart
+    bool shadowed;
+    // in scope at the point the scan has reached
+    bool declared;
+    // a pointer to it leaves the function, or is otherwise used as a value
+    bool escapes;
+
+    // for a pointer local declared as `var p: ptr T = ptr target;`, the
+    // local it points at. only kept while every use of `p` is a dereference
+    // and `p` is never assigned or has its own address taken.
+    Local *target;
+    bool aliasOk;
+};
+
+typedef struct Scan {
+    // the module the function is in, NULL if unknown
+    const Ast_Module *m;
+
+    Local *locals;
+    size_t len;
+    size_t capacity;
+
+    // the locals in scope, innermost last
+    Local **scope;
+    size_t scopeLen;
+    size_t scopeCapacity;
+} Scan;
+
+// how the value of an expression is used by its parent
+typedef enum Use {
+    Use_value,
+    // operand of `val`, or the target of a store through `val`
+    Use_deref,
+} Use;
+
+static Local *find(Scan *s, const char *name) {
+    for (size_t i = 0; i < s->len; i++) {
+        if (!strcmp(s->locals[i].decl->name, name))
+            return &s->locals[i];
+    }
+    return NULL;
+}
+
+static bool isGlobal(const Scan *s, const char *name) {
+    for (size_t i = 0; s->m != NULL && i < s->m->declc; i++) {
+        const Ast_Decl *d = &s->m->declv[i];
+        if (!strcmp(d->type == Decl_fn ? d->fn.name : d->var.name, name))
+            return true;
+    }
+    return false;
+}
+
+static void ambiguous(Local *l) {
+    l->shadowed = true;
+    l->escapes = true;
+    l->aliasOk = false;
+}
+
+static void addLocal(Scan *s, Decl_Var *decl) {
+    // the same name declared twice in one function, or shared with a global,
+    // is not worth telling apart, so all of them stay in memory
+    Local *prev = find(s, decl->name);
+    if (prev != NULL)
+        ambiguous(prev);
+    bool shadowed = prev != NULL || isGlobal(s, decl->name);
+
+    if (s->len == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 16;
+        s->locals = realloc(s->locals, s->capacity * sizeof(Local));
+        assert(s->locals != NULL);
+    }
+    s->locals[s->len++] = (Local){
+        .decl = decl,
+        .escapes = shadowed,
+        .shadowed = shadowed,
+        .aliasOk = !shadowed,
+    };
+}
+
+static void collect(Scan *s, Ast_Stmt *stmtv, size_t stmtc) {
+    for (size_t i = 0; i < stmtc; i++) {
+        Ast_Stmt *stmt = &stmtv[i];
+        while (stmt->type == Stmt_label && stmt->label->stmt != NULL)
+            stmt = stmt->label->stmt;
+
+        if (stmt->type == Stmt_decl)
+            addLocal(s, stmt->decl);
+        else if (stmt->type == Stmt_if)
+            collect(s, stmt->if_stmt->stmtv, stmt->if_stmt->stmtc);
+    }
+}
+
+// scanning ////////////////////////////////////////////////////////////////////
+
+static void enterScope(Scan *s, Local *l) {
+    if (s->scopeLen == s->scopeCapacity) {
+        s->scopeCapacity = s->scopeCapacity ? s->scopeCapacity * 2 : 16;
+        s->scope = realloc(s->scope, s->scopeCapacity * sizeof(Local *));
+        assert(s->scope != NULL);
+    }
+    s->scope[s->scopeLen++] = l;
+    l->declared = true;
+}
+
+static void leaveScopes(Scan *s, size_t len) {
+    while (s->scopeLen > len)
+        s->scope[--s->scopeLen]->declared = false;
+}
+
+// the local `name` refers to at this point of the scan. a local of that name
+// out of scope means the name is something else here, a global, and the
+// local can no longer be followed by name.
+static Local *lookup(Scan *s, const char *name) {
+    Local *l = find(s, name);
+    if (l != NULL && !l->declared) {
+        ambiguous(l);
+        return NULL;
+    }
+    return l;
+}
+
+static void scanExpr(Scan *s, Ast_Expr *e, Use use) {
+    switch (e->type) {
+    case Expr_ptr: {
+        Local *l = lookup(s, e->ptr);
+        if (l == NULL)
+            return; // globals live in memory regardless
+
+        l->addrTaken = true;
+        if (use != Use_deref)
+            l->escapes = true;
+        // whatever `l` holds, it is no longer only used through `val`
+        l->aliasOk = false;
+        return;
+    }
+
+    case Expr_ident: {
+        Local *l = lookup(s, e->ident);
+        if (l != NULL && use != Use_deref)
+            l->aliasOk = false;
+        return;
+    }
+
+    case Expr_val:
+        scanExpr(s, e->val, Use_deref);
+        return;
+
+    case Expr_binOp:
+        scanExpr(s, e->binOp->left, Use_value);
+        scanExpr(s, e->binOp->right, Use_value);
+        return;
+
+    case Expr_fnCall:
+        scanExpr(s, e->fnCall->head, Use_value);
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            scanExpr(s, &e->fnCall->argv[i], Use_value);
+        return;
+
+    case Expr_asType:
+        scanExpr(s, e->asType->expr, Use_value);
+        return;
+
+    case Expr_lit:
+        return;
+    }
+}
+
+static void scanDecl(Scan *s, Decl_Var *decl, bool plain) {
+    Local *l = find(s, decl->name);
+    assert(l != NULL);
+
+    // `var p: ptr T = ptr x;` is the start of an alias, as long as `x` is a
+    // local and the declaration can be dropped later on. `p` must be the
+    // only local of that name, or a use of it could belong to another.
+    Ast_Expr *init = decl->init;
+    if (plain && !l->shadowed && init != NULL && init->type == Expr_ptr) {
+        Local *target = lookup(s, init->ptr);
+        if (target != NULL && target != l && !target->shadowed) {
+            target->addrTaken = true;
+            // stores through `p` may change what `x` holds, so if `x` is an
+            // alias itself it is no longer one
+            target->aliasOk = false;
+            l->target = target;
+            enterScope(s, l);
+            return;
+        }
+    }
+
+    if (init != NULL)
+        scanExpr(s, init, Use_value);
+    enterScope(s, l);
+}
+
+static void scanStmts(Scan *s, Ast_Stmt *stmtv, size_t stmtc) {
+    for (size_t i = 0; i < stmtc; i++) {
+        Ast_Stmt *stmt = &stmtv[i];
+        bool plain = true;
+        while (stmt->type == Stmt_label && stmt->label->stmt != NULL) {
+            stmt = stmt->label->stmt;
+            plain = false;
+        }
+
+        switch (stmt->type) {
+        case Stmt_decl:
+            scanDecl(s, stmt->decl, plain);
+            break;
+
+        case Stmt_assign: {
+            Ast_Expr *lvalue = stmt->assign->lvalue;
+            if (lvalue->type == Expr_ident) {
+                Local *l = lookup(s, lvalue->ident);
+                if (l != NULL)
+                    l->aliasOk = false;
+            } else if (lvalue->type == Expr_val) {
+                scanExpr(s, lvalue->val, Use_deref);
+            } else {
+                scanExpr(s, lvalue, Use_value);
+            }
+            scanExpr(s, stmt->assign->rvalue, Use_value);
+            break;
+        }
+
+        case Stmt_if: {
+            scanExpr(s, stmt->if_stmt->cond, Use_value);
+            size_t outer = s->scopeLen;
+            scanStmts(s, stmt->if_stmt->stmtv, stmt->if_stmt->stmtc);
+            leaveScopes(s, outer);
+            break;
+        }
+
+        case Stmt_return:
+            if (stmt->return_stmt != NULL)
+                scanExpr(s, stmt->return_stmt, Use_value);
+            break;
+
+        case Stmt_expr:
+            scanExpr(s, stmt->expr, Use_value);
+            break;
+
+        case Stmt_label:
+        case Stmt_goto:
+        case Stmt_break:
+            break;
+        }
+    }
+}
+
+// rewriting ///////////////////////////////////////////////////////////////////
+
+// the local that `val e` reads or writes directly, if it can be promoted
+static Local *derefTarget(Scan *s, Ast_Expr *e) {
+    Local *l = NULL;
+    if (e->type == Expr_ptr) {
+        l = find(s, e->ptr);
+    } else if (e->type == Expr_ident) {
+        l = find(s, e->ident);
+        l = l != NULL ? l->target : NULL;
+    }
+    return l != NULL && !l->escapes ? l : NULL;
+}
+
+static void rewriteExpr(Scan *s, Ast_Expr *e) {
+    switch (e->type) {
+    case Expr_val: {
+        rewriteExpr(s, e->val);
+        Local *l = derefTarget(s, e->val);
+        if (l != NULL)
+            *e = (Ast_Expr){.type = Expr_ident, .ident = l->decl->name};
+        return;
+    }
+
+    case Expr_binOp:
+        rewriteExpr(s, e->binOp->left);
+        rewriteExpr(s, e->binOp->right);
+        return;
+
+    case Expr_fnCall:
+        rewriteExpr(s, e->fnCall->head);
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            rewriteExpr(s, &e->fnCall->argv[i]);
+        return;
+
+    case Expr_asType:
+        rewriteExpr(s, e->asType->expr);
+        return;
+
+    case Expr_ptr:
+    case Expr_ident:
+    case Expr_lit:
+        return;
+    }
+}
+
+// a pointer local whose every use has been rewritten away
+static bool deadAlias(Scan *s, Ast_Stmt *stmt) {
+    if (stmt->type != Stmt_decl)
+        return false;
+    Local *l = find(s, stmt->decl->name);
+    return l != NULL && l->target != NULL && !l->target->escapes;
+}
+
+static void rewriteStmts(Scan *s, Ast_Stmt *stmtv, size_t *stmtc) {
+    size_t kept = 0;
+    for (size_t i = 0; i < *stmtc; i++) {
+        if (deadAlias(s, &stmtv[i]))
+            continue;
+
+        Ast_Stmt *stmt = &stmtv[i];
+        while (stmt->type == Stmt_label && stmt->label->stmt != NULL)
+            stmt = stmt->label->stmt;
+
+        switch (stmt->type) {
+        case Stmt_decl:
+            if (stmt->decl->init != NULL)
+                rewriteExpr(s, stmt->decl->init);
+            break;
+        case Stmt_assign:
+            rewriteExpr(s, stmt->assign->lvalue);
+            rewriteExpr(s, stmt->assign->rvalue);
+            break;
+        case Stmt_if:
+            rewriteExpr(s, stmt->if_stmt->cond);
+            rewriteStmts(s, stmt->if_stmt->stmtv, &stmt->if_stmt->stmtc);
+            break;
+        case Stmt_return:
+            if (stmt->return_stmt != NULL)
+                rewriteExpr(s, stmt->return_stmt);
+            break;
+        case Stmt_expr:
+            rewriteExpr(s, stmt->expr);
+            break;
+        case Stmt_label:
+        case Stmt_goto:
+        case Stmt_break:
+            break;
+        }
+
+        stmtv[kept++] = stmtv[i];
+    }
+    *stmtc = kept;
+}
+
+static size_t analyzeFn(Decl_Fn *fn, const Ast_Module *m) {
+    assert(!fn->body_pending);
+    Scan s = {.m = m};
+    for (size_t i = 0; i < fn->argc; i++)
+        addLocal(&s, &fn->argv[i]);
+    collect(&s, fn->stmtv, fn->stmtc);
+    for (size_t i = 0; i < fn->argc; i++)
+        enterScope(&s, &s.locals[i]);
+
+    scanStmts(&s, fn->stmtv, fn->stmtc);
+
+    // a broken alias hands its target out like any other pointer
+    for (size_t i = 0; i < s.len; i++) {
+        Local *l = &s.locals[i];
+        if (l->target != NULL && !l->aliasOk) {
+            l->target->escapes = true;
+            l->target = NULL;
+        }
+    }
+
+    size_t promoted = 0;
+    for (size_t i = 0; i < s.len; i++) {
+        Local *l = &s.locals[i];
+        l->decl->in_register = !l->escapes;
+        if (l->addrTaken && !l->escapes)
+            promoted++;
+    }
+
+    rewriteStmts(&s, fn->stmtv, &fn->stmtc);
+
+    free(s.locals);
+    free(s.scope);
+    return promoted;
+}
+
+size_t Escape_analyzeFn(Decl_Fn *fn) {
+    return analyzeFn(fn, NULL);
+}
+
+size_t Escape_analyzeModule(Ast_Module *m) {
+    size_t promoted = 0;
+    for (size_t i = 0; i < m->declc; i++) {
+        if (m->declv[i].type == Decl_fn)
+            promoted += analyzeFn(&m->declv[i].fn, m);
+    }
+    return promoted;
+}
+
+#ifdef TESTING
+
+#include "../parser.h"
+#include <stdio.h>
+
+// tests build their trees out of static pools, nothing is freed
+static Ast_Expr exprs[128];
+static size_t nexprs;
+static Expr_BinOp binOps[32];
+static size_t nbinOps;
+static Expr_FnCall calls[8];
+static size_t ncalls;
+static Stmt_Assign assigns[16];
+static size_t nassigns;
+static Stmt_If ifs[4];
+static size_t nifs;
+static Decl_Var vars[32];
+static size_t nvars;
+
+static Ast_Expr *newExpr(Ast_Expr e) {
+    assert(nexprs < sizeof exprs / sizeof *exprs);
+    exprs[nexprs] = e;
+    return &exprs[nexprs++];
+}
+
+static Ast_Expr *ident(char *name) {
+    return newExpr((Ast_Expr){.type = Expr_ident, .ident = name});
+}
+static Ast_Expr *ptrOf(char *name) {
+    return newExpr((Ast_Expr){.type = Expr_ptr, .ptr = name});
+}
+static Ast_Expr *valOf(Ast_Expr *e) {
+    return newExpr((Ast_Expr){.type = Expr_val, .val = e});
+}
+static Ast_Expr *plus(Ast_Expr *l, Ast_Expr *r) {
+    binOps[nbinOps] = (Expr_BinOp){.type = BinOp_plus, .left = l, .right = r};
+    return newExpr((Ast_Expr){.type = Expr_binOp, .binOp = &binOps[nbinOps++]});
+}
+static Ast_Expr *lit(size_t n) {
+    static Expr_Lit lits[8];
+    static size_t nlits;
+    lits[nlits] = (Expr_Lit){.type = Lit_int, .integer = n};
+    return newExpr((Ast_Expr){.type = Expr_lit, .lit = &lits[nlits++]});
+}
+static Ast_Expr *call1(char *fn, Ast_Expr *arg) {
+    calls[ncalls] = (Expr_FnCall){.head = ident(fn), .argc = 1, .argv = arg};
+    return newExpr((Ast_Expr){.type = Expr_fnCall, .fnCall = &calls[ncalls++]});
+}
+
+static Ast_Stmt declStmt(char *name, Ast_Expr *init) {
+    vars[nvars] = (Decl_Var){.name = name, .init = init};
+    return (Ast_Stmt){.type = Stmt_decl, .decl = &vars[nvars++]};
+}
+static Ast_Stmt assignStmt(Ast_Expr *lvalue, Ast_Expr *rvalue) {
+    assigns[nassigns] = (Stmt_Assign){.lvalue = lvalue, .rvalue = rvalue};
+    return (Ast_Stmt){.type = Stmt_assign, .assign = &assigns[nassigns++]};
+}
+static Ast_Stmt ifStmt(Ast_Expr *cond, Ast_Stmt *stmtv, size_t stmtc) {
+    ifs[nifs] = (Stmt_If){.cond = cond, .stmtc = stmtc, .stmtv = stmtv};
+    return (Ast_Stmt){.type = Stmt_if, .if_stmt = &ifs[nifs++]};
+}
+static Ast_Stmt exprStmt(Ast_Expr *e) {
+    return (Ast_Stmt){.type = Stmt_expr, .expr = e};
+}
+static Ast_Stmt returnStmt(Ast_Expr *e) {
+    return (Ast_Stmt){.type = Stmt_return, .return_stmt = e};
+}
+
+void test_direct() {
+    // var _x = 1; var _y = 2;
+    // val ptr _x = 5;
+    // _g(ptr _y);
+    // return val ptr _x + val ptr _y;
+    Ast_Stmt body[] = {
+        declStmt("_x", NULL),
+        declStmt("_y", NULL),
+        assignStmt(valOf(ptrOf("_x")), ident("_y")),
+        exprStmt(call1("_g", ptrOf("_y"))),
+        returnStmt(plus(valOf(ptrOf("_x")), valOf(ptrOf("_y")))),
+    };
+    Decl_Fn fn = {.name = "_f", .stmtc = 5, .stmtv = body};
+
+    assert(Escape_analyzeFn(&fn) == 1);
+    assert(body[0].decl->in_register);
+    assert(!body[1].decl->in_register);
+
+    Ast_Expr *lvalue = body[2].assign->lvalue;
+    assert(lvalue->type == Expr_ident && !strcmp(lvalue->ident, "_x"));
+
+    Expr_BinOp *ret = body[4].return_stmt->binOp;
+    assert(ret->left->type == Expr_ident);
+    assert(ret->right->type == Expr_val);
+}
+
+void test_alias() {
+    // fn _f(_a: int)
+    // var _p = ptr _a;
+    // val _p = val _p + 1;
+    // var _q = ptr _a;
+    // return val _q;
+    Decl_Var args[] = {{.name = "_a"}};
+    Ast_Stmt body[] = {
+        declStmt("_p", ptrOf("_a")),
+        assignStmt(valOf(ident("_p")), plus(valOf(ident("_p")), ident("_p"))),
+        declStmt("_q", ptrOf("_a")),
+        returnStmt(valOf(ident("_q"))),
+    };
+    // the `+ _p` reads the pointer itself, so `_p` is not an alias
+    Decl_Fn fn = {.name = "_f", .argc = 1, .argv = args, .stmtc = 4,
+                  .stmtv = body};
+
+    assert(Escape_analyzeFn(&fn) == 0);
+    assert(!args[0].in_register);
+    assert(fn.stmtc == 4);
+
+    // without it, both pointers are only dereferenced
+    body[1].assign->rvalue->binOp->right = ident("_b");
+    fn.stmtc = 4;
+    assert(Escape_analyzeFn(&fn) == 1);
+    assert(args[0].in_register);
+
+    // both alias declarations are gone
+    assert(fn.stmtc == 2);
+    assert(body[0].type == Stmt_assign);
+    Ast_Expr *lvalue = body[0].assign->lvalue;
+    assert(lvalue->type == Expr_ident && !strcmp(lvalue->ident, "_a"));
+    assert(body[0].assign->rvalue->binOp->left->type == Expr_ident);
+    assert(body[1].type == Stmt_return);
+    assert(body[1].return_stmt->type == Expr_ident);
+    assert(!strcmp(body[1].return_stmt->ident, "_a"));
+}
+
+void test_escapes() {
+    // var _x = 0;
+    // var _p = ptr _x;
+    // return _p;
+    Ast_Stmt body[] = {
+        declStmt("_x", NULL),
+        declStmt("_p", ptrOf("_x")),
+        returnStmt(ident("_p")),
+    };
+    Decl_Fn fn = {.name = "_f", .stmtc = 3, .stmtv = body};
+
+    assert(Escape_analyzeFn(&fn) == 0);
+    assert(!body[0].decl->in_register);
+    assert(body[1].decl->in_register);
+    assert(fn.stmtc == 3);
+}
+
+void test_shadowed() {
+    // fn _f(_c: bool)
+    // var _x = 0; var _y = 0;
+    // if (_c) { var _p = ptr _x; val _p = 1; }
+    // if (_c) { var _p = ptr _y; val _p = 2; }
+    // return _x;
+    Decl_Var args[] = {{.name = "_c"}};
+    Ast_Stmt first[] = {
+        declStmt("_p", ptrOf("_x")),
+        assignStmt(valOf(ident("_p")), lit(1)),
+    };
+    Ast_Stmt second[] = {
+        declStmt("_p", ptrOf("_y")),
+        assignStmt(valOf(ident("_p")), lit(2)),
+    };
+    Ast_Stmt body[] = {
+        declStmt("_x", lit(0)),
+        declStmt("_y", lit(0)),
+        ifStmt(ident("_c"), first, 2),
+        ifStmt(ident("_c"), second, 2),
+        returnStmt(ident("_x")),
+    };
+    Decl_Fn fn = {.name = "_f", .argc = 1, .argv = args, .stmtc = 5,
+                  .stmtv = body};
+
+    // neither `_p` can be told apart from the other, so both stay pointers
+    assert(Escape_analyzeFn(&fn) == 0);
+    assert(!body[0].decl->in_register && !body[1].decl->in_register);
+    assert(fn.stmtc == 5);
+    assert(first[1].assign->lvalue->type == Expr_val);
+    assert(second[1].assign->lvalue->type == Expr_val);
+}
+
+void test_ptr_to_ptr() {
+    // var _x = 0; var _y = 0;
+    // var _p = ptr _x; var _pp = ptr _p;
+    // val _pp = ptr _y;
+    // val _p = 7;
+    // return _x;
+    Ast_Stmt body[] = {
+        declStmt("_x", lit(0)),
+        declStmt("_y", lit(0)),
+        declStmt("_p", ptrOf("_x")),
+        declStmt("_pp", ptrOf("_p")),
+        assignStmt(valOf(ident("_pp")), ptrOf("_y")),
+        assignStmt(valOf(ident("_p")), lit(7)),
+        returnStmt(ident("_x")),
+    };
+    Decl_Fn fn = {.name = "_f", .stmtc = 7, .stmtv = body};
+
+    // `_p` is repointed through `_pp`, so it is no alias of `_x`. only
+    // `_pp` goes, and the store through `_p` stays.
+    assert(Escape_analyzeFn(&fn) == 1);
+    assert(!body[0].decl->in_register);
+    assert(body[2].decl->in_register);
+    assert(fn.stmtc == 6);
+    assert(body[2].type == Stmt_decl && !strcmp(body[2].decl->name, "_p"));
+
+    Ast_Expr *repoint = body[3].assign->lvalue;
+    assert(repoint->type == Expr_ident && !strcmp(repoint->ident, "_p"));
+    Ast_Expr *store = body[4].assign->lvalue;
+    assert(store->type == Expr_val && store->val->type == Expr_ident);
+    assert(!strcmp(store->val->ident, "_p"));
+}
+
+static char treeArena[1 << 14];
+
+// the tree lives in `treeArena`
+static void parse(const char *src, Ast_Module *m) {
+    TokBuf toks;
+    TokBuf_init(&toks);
+    assert(TokBuf_lex(&toks, src, strlen(src), 1));
+    Parser p;
+    assert(Parser_initTokBuf(&p, "e.l1", src, strlen(src), &toks, false));
+    static FixedBuf fb;
+    static Alloc fba;
+    fb = (FixedBuf){.data = treeArena, .capacity = sizeof treeArena};
+    fba = Alloc_fromFixedBuf(&fb);
+    p.alloc = &fba;
+    assert(Parser_parseModule(&p, m));
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+}
+
+void test_parsed() {
+    // a label closing a block has no statement
+    Ast_Module m;
+    parse("export fn _f(_n: int) int {\n"
+          "    var _x: int = _n;\n"
+          "    var _p: ptr int = ptr _x;\n"
+          "    if (_n > 0) { val _p = 1; _end: }\n"
+          "    return _x;\n"
+          "}\n",
+          &m);
+    assert(Escape_analyzeModule(&m) == 1);
+
+    Decl_Fn *fn = &m.declv[0].fn;
+    assert(fn->stmtc == 3);
+    assert(fn->stmtv[0].decl->in_register);
+    Ast_Expr *store = fn->stmtv[1].if_stmt->stmtv[0].assign->lvalue;
+    assert(store->type == Expr_ident && !strcmp(store->ident, "_x"));
+    assert(fn->stmtv[1].if_stmt->stmtv[1].label->stmt == NULL);
+}
+
+void test_out_of_scope() {
+    // `_p` points at the global `_x`, the local comes later
+    Ast_Module m;
+    parse("var _x: int = 5;\n"
+          "export fn _f() int {\n"
+          "    var _p: ptr int = ptr _x;\n"
+          "    var _x: int = 0;\n"
+          "    val _p = 1;\n"
+          "    return _x;\n"
+          "}\n",
+          &m);
+    assert(Escape_analyzeModule(&m) == 0);
+    Decl_Fn *fn = &m.declv[1].fn;
+    assert(fn->stmtc == 4);
+    assert(!fn->stmtv[1].decl->in_register);
+    assert(fn->stmtv[2].assign->lvalue->type == Expr_val);
+
+    // the same without the module to tell `_x` is a global
+    parse("var _x: int = 5;\n"
+          "export fn _f() int {\n"
+          "    var _p: ptr int = ptr _x;\n"
+          "    var _x: int = 0;\n"
+          "    val _p = 1;\n"
+          "    return _x;\n"
+          "}\n",
+          &m);
+    fn = &m.declv[1].fn;
+    assert(Escape_analyzeFn(fn) == 0);
+    assert(fn->stmtc == 4);
+    assert(fn->stmtv[2].assign->lvalue->type == Expr_val);
+
+    // and with the local gone at the end of its block
+    parse("var _x: int = 5;\n"
+          "export fn _g(_c: bool) int {\n"
+          "    if (_c) { var _x: int = 0; }\n"
+          "    var _p: ptr int = ptr _x;\n"
+          "    val _p = 1;\n"
+          "    return 0;\n"
+          "}\n",
+          &m);
+    fn = &m.declv[1].fn;
+    assert(Escape_analyzeFn(fn) == 0);
+    assert(fn->stmtc == 4);
+    assert(fn->stmtv[2].assign->lvalue->type == Expr_val);
+}
+
+int main() {
+    printf("escape direct...");
+    test_direct();
+    printf("OK!\n");
+    printf("escape alias...");
+    test_alias();
+    printf("OK!\n");
+    printf("escape escapes...");
+    test_escapes();
+    printf("OK!\n");
+    printf("escape shadowed...");
+    test_shadowed();
+    printf("OK!\n");
+    printf("escape ptr to ptr...");
+    test_ptr_to_ptr();
+    printf("OK!\n");
+    printf("escape parsed...");
+    test_parsed();
+    printf("OK!\n");
+    printf("escape out of scope...");
+    test_out_of_scope();
+    printf("OK!\n");
+}
+
+#endif
@@ -0,0 +1,25 @@
+// escape analysis for `ptr`/`val`. finds the locals whose address is only
+// ever dereferenced on the spot, or through a pointer local that is, so they
+// can live in registers instead of memory.
+
+#pragma once
+
+#include "../ast.h"
+#include <stddef.h>
+
+// marks every local of `fn` whose address never escapes as `in_register`,
+// and rewrites loads and stores through pointers to those locals into direct
+// accesses:
+//
+//   val ptr x       ->  x
+//   var p: ptr int = ptr x;  ...  val p   ->  x   (and `p` is dropped)
+//
+// a local escapes when a pointer to it is stored, passed, returned or used in
+// arithmetic. a name used outside the scope of the local it matches is taken
+// to be a global, and the local is left alone. returns the number of
+// address-taken locals that were promoted.
+size_t Escape_analyzeFn(Decl_Fn *fn);
+
+// runs `Escape_analyzeFn()` over every function in `m`, also leaving alone
+// every local that has the name of one of the module's globals.
+size_t Escape_analyzeModule(Ast_Module *m);
@@ -0,0 +1,1382 @@
+#include "loop.h"
+#include <stdint.h>
+#include <string.h>
+
+#define NONE SIZE_MAX
+
+static void *newNode(Alloc *alloc, size_t size) {
+    void *node = Mem_alloc(alloc, size);
+    assert(node != NULL);
+    return node;
+}
+
+static void *grow(void *items, size_t *capacity, size_t len, size_t size) {
+    if (len < *capacity)
+        return items;
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * size);
+    assert(items != NULL);
+    return items;
+}
+
+static bool exprEqual(const Ast_Expr *a, const Ast_Expr *b) {
+    if (a->type != b->type)
+        return false;
+    switch (a->type) {
+    case Expr_lit:
+        return a->lit->type == b->lit->type &&
+               (a->lit->type == Lit_int ? a->lit->integer == b->lit->integer
+                                        : a->lit->boolean == b->lit->boolean);
+    case Expr_ident:
+        return !strcmp(a->ident, b->ident);
+    case Expr_binOp:
+        return a->binOp->type == b->binOp->type &&
+               exprEqual(a->binOp->left, b->binOp->left) &&
+               exprEqual(a->binOp->right, b->binOp->right);
+    default:
+        return false;
+    }
+}
+
+static bool isIntType(const Ast_TypeExpr *t) {
+    while (t != NULL && t->type == TypeExpr_const)
+        t = t->inner;
+    return t != NULL && t->type == TypeExpr_int;
+}
+
+static bool isIntLit(const Ast_Expr *e) {
+    return e->type == Expr_lit && e->lit->type == Lit_int;
+}
+
+// control flow ////////////////////////////////////////////////////////////////
+
+// statements are flattened in source order, an `if` followed by its body,
+// so falling out of a body continues at the next node.
+typedef enum NodeKind {
+    Node_plain,
+    Node_label,
+    Node_if,
+    Node_goto,
+    Node_return,
+} NodeKind;
+
+typedef struct Node {
+    NodeKind kind;
+    Ast_Stmt *stmt;
+
+    // the list holding the statement, NULL for the statement of a label
+    Ast_Stmt **listv;
+    size_t *listc;
+    size_t index;
+    // the `if` or label the statement is nested in, NONE at the top
+    size_t parent;
+
+    // `if`: the node after the body. `goto`: the target, NONE if missing.
+    size_t jump;
+} Node;
+
+typedef struct Var {
+    const char *name;
+    bool isInt;
+    bool addrTaken;
+    // declared more than once, so a name alone does not say which
+    bool ambiguous;
+    // created by this pass
+    bool temp;
+    // node of the declaration, NONE for parameters and temporaries
+    size_t decl;
+} Var;
+
+typedef struct Graph {
+    Decl_Fn *fn;
+    Alloc *alloc;
+
+    Node *nodes;
+    size_t len;
+    size_t capacity;
+
+    size_t (*succs)[2];
+    // predecessors of node `i` are `predv[predStart[i]..predStart[i + 1])`
+    size_t *predStart;
+    size_t *predv;
+
+    // immediate dominators, NONE for unreachable nodes
+    size_t *idom;
+    size_t *rpoNum;
+
+    // parameters and locals, searched linearly
+    Var *vars;
+    size_t varc;
+    size_t varCapacity;
+} Graph;
+
+static size_t addNode(Graph *g, Node n) {
+    g->nodes = grow(g->nodes, &g->capacity, g->len, sizeof(Node));
+    g->nodes[g->len] = n;
+    return g->len++;
+}
+
+static void flattenList(Graph *g, Ast_Stmt **listv, size_t *listc,
+                        size_t parent);
+
+static void flattenStmt(Graph *g, Ast_Stmt *stmt, Ast_Stmt **listv,
+                        size_t *listc, size_t index, size_t parent) {
+    Node n = {.stmt = stmt, .listv = listv, .listc = listc, .index = index,
+              .parent = parent, .jump = NONE};
+    switch (stmt->type) {
+    case Stmt_label: {
+        n.kind = Node_label;
+        size_t at = addNode(g, n);
+        if (stmt->label->stmt != NULL)
+            flattenStmt(g, stmt->label->stmt, NULL, NULL, 0, at);
+        break;
+    }
+    case Stmt_if: {
+        n.kind = Node_if;
+        size_t at = addNode(g, n);
+        flattenList(g, &stmt->if_stmt->stmtv, &stmt->if_stmt->stmtc, at);
+        g->nodes[at].jump = g->len;
+        break;
+    }
+    case Stmt_goto:
+        n.kind = Node_goto;
+        addNode(g, n);
+        break;
+    case Stmt_return:
+        n.kind = Node_return;
+        addNode(g, n);
+        break;
+    default:
+        n.kind = Node_plain;
+        addNode(g, n);
+        break;
+    }
+}
+
+static void flattenList(Graph *g, Ast_Stmt **listv, size_t *listc,
+                        size_t parent) {
+    for (size_t i = 0; i < *listc; i++)
+        flattenStmt(g, &(*listv)[i], listv, listc, i, parent);
+}
+
+static void resolveGotos(Graph *g) {
+    for (size_t i = 0; i < g->len; i++) {
+        if (g->nodes[i].kind != Node_goto)
+            continue;
+        for (size_t j = 0; j < g->len; j++) {
+            if (g->nodes[j].kind == Node_label &&
+                !strcmp(g->nodes[j].stmt->label->name,
+                        g->nodes[i].stmt->goto_stmt)) {
+                g->nodes[i].jump = j;
+                break;
+            }
+        }
+    }
+}
+
+static void linkNodes(Graph *g) {
+    size_t n = g->len;
+    g->succs = malloc((n + 1) * sizeof *g->succs);
+    g->predStart = calloc(n + 2, sizeof(size_t));
+    assert(g->succs != NULL && g->predStart != NULL);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t next = i + 1 < n ? i + 1 : NONE;
+        size_t *s = g->succs[i];
+        s[0] = s[1] = NONE;
+        switch (g->nodes[i].kind) {
+        case Node_plain:
+        case Node_label:
+            s[0] = next;
+            break;
+        case Node_if:
+            s[0] = next;
+            if (g->nodes[i].jump < n && g->nodes[i].jump != next)
+                s[1] = g->nodes[i].jump;
+            break;
+        case Node_goto:
+            s[0] = g->nodes[i].jump;
+            break;
+        case Node_return:
+            break;
+        }
+        for (int k = 0; k < 2; k++) {
+            if (s[k] != NONE)
+                g->predStart[s[k] + 1]++;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        g->predStart[i + 1] += g->predStart[i];
+    g->predv = malloc((g->predStart[n] + 1) * sizeof(size_t));
+    size_t *fill = calloc(n + 1, sizeof(size_t));
+    assert(g->predv != NULL && fill != NULL);
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < 2; k++) {
+            size_t s = g->succs[i][k];
+            if (s != NONE)
+                g->predv[g->predStart[s] + fill[s]++] = i;
+        }
+    }
+    free(fill);
+}
+
+static size_t intersect(const Graph *g, size_t a, size_t b) {
+    while (a != b) {
+        while (g->rpoNum[a] > g->rpoNum[b])
+            a = g->idom[a];
+        while (g->rpoNum[b] > g->rpoNum[a])
+            b = g->idom[b];
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative dominator algorithm
+static void findDominators(Graph *g) {
+    size_t n = g->len;
+    g->idom = malloc((n + 1) * sizeof(size_t));
+    g->rpoNum = malloc((n + 1) * sizeof(size_t));
+    size_t *order = malloc((n + 1) * sizeof(size_t));
+    size_t *stack = malloc((n + 1) * sizeof(size_t));
+    uint8_t *state = calloc(n + 1, 1);
+    assert(g->idom && g->rpoNum && order && stack && state);
+    for (size_t i = 0; i < n; i++)
+        g->idom[i] = g->rpoNum[i] = NONE;
+    if (n == 0)
+        goto done;
+
+    // post order by an explicit depth first search. `state` counts the
+    // successors visited, plus one once the node is on the stack.
+    size_t postc = 0, top = 0;
+    stack[top++] = 0;
+    state[0] = 1;
+    while (top > 0) {
+        size_t v = stack[top - 1];
+        if (state[v] <= 2) {
+            size_t s = g->succs[v][state[v]++ - 1];
+            if (s != NONE && state[s] == 0) {
+                state[s] = 1;
+                stack[top++] = s;
+            }
+            continue;
+        }
+        order[postc++] = v;
+        top--;
+    }
+    for (size_t i = 0; i < postc; i++)
+        g->rpoNum[order[i]] = postc - 1 - i;
+
+    g->idom[0] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = postc; i-- > 0;) {
+            size_t b = order[i];
+            if (b == 0)
+                continue;
+            size_t idom = NONE;
+            for (size_t k = g->predStart[b]; k < g->predStart[b + 1]; k++) {
+                size_t p = g->predv[k];
+                if (g->idom[p] == NONE)
+                    continue;
+                idom = idom == NONE ? p : intersect(g, p, idom);
+            }
+            if (idom != g->idom[b]) {
+                g->idom[b] = idom;
+                changed = true;
+            }
+        }
+    }
+
+done:
+    free(order);
+    free(stack);
+    free(state);
+}
+
+static bool dominates(const Graph *g, size_t a, size_t b) {
+    if (g->idom[b] == NONE)
+        return false;
+    while (b != a && b != 0)
+        b = g->idom[b];
+    return b == a;
+}
+
+// variables ///////////////////////////////////////////////////////////////////
+
+static Var *findVar(Graph *g, const char *name) {
+    for (size_t i = 0; i < g->varc; i++) {
+        if (!strcmp(g->vars[i].name, name))
+            return &g->vars[i];
+    }
+    return NULL;
+}
+
+static Var *addVar(Graph *g, const char *name, bool isInt, size_t decl) {
+    Var *v = findVar(g, name);
+    if (v != NULL) {
+        v->ambiguous = true;
+        return v;
+    }
+    g->vars = grow(g->vars, &g->varCapacity, g->varc, sizeof(Var));
+    g->vars[g->varc] = (Var){.name = name, .isInt = isInt, .decl = decl};
+    return &g->vars[g->varc++];
+}
+
+// the expressions a node evaluates, not counting nested statements
+static size_t nodeExprs(const Node *n, Ast_Expr **out) {
+    const Ast_Stmt *s = n->stmt;
+    switch (s->type) {
+    case Stmt_decl:
+        out[0] = s->decl->init;
+        return out[0] != NULL;
+    case Stmt_assign:
+        out[0] = s->assign->rvalue;
+        if (s->assign->lvalue->type != Expr_val)
+            return 1;
+        // the address stored through is read
+        out[1] = s->assign->lvalue->val;
+        return 2;
+    case Stmt_if:
+        out[0] = s->if_stmt->cond;
+        return 1;
+    case Stmt_return:
+        out[0] = s->return_stmt;
+        return out[0] != NULL;
+    case Stmt_expr:
+        out[0] = s->expr;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void markAddrTaken(Graph *g, const Ast_Expr *e) {
+    switch (e->type) {
+    case Expr_ptr: {
+        Var *v = findVar(g, e->ptr);
+        if (v != NULL)
+            v->addrTaken = true;
+        break;
+    }
+    case Expr_binOp:
+        markAddrTaken(g, e->binOp->left);
+        markAddrTaken(g, e->binOp->right);
+        break;
+    case Expr_fnCall:
+        markAddrTaken(g, e->fnCall->head);
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            markAddrTaken(g, &e->fnCall->argv[i]);
+        break;
+    case Expr_val:
+        markAddrTaken(g, e->val);
+        break;
+    case Expr_asType:
+        markAddrTaken(g, e->asType->expr);
+        break;
+    case Expr_ident:
+    case Expr_lit:
+        break;
+    }
+}
+
+static bool mentions(const Ast_Expr *e, const char *name) {
+    switch (e->type) {
+    case Expr_ident:
+        return !strcmp(e->ident, name);
+    case Expr_ptr:
+        return !strcmp(e->ptr, name);
+    case Expr_binOp:
+        return mentions(e->binOp->left, name) ||
+               mentions(e->binOp->right, name);
+    case Expr_fnCall:
+        for (size_t i = 0; i < e->fnCall->argc; i++) {
+            if (mentions(&e->fnCall->argv[i], name))
+                return true;
+        }
+        return mentions(e->fnCall->head, name);
+    case Expr_val:
+        return mentions(e->val, name);
+    case Expr_asType:
+        return mentions(e->asType->expr, name);
+    case Expr_lit:
+        return false;
+    }
+    return false;
+}
+
+static void buildGraph(Graph *g, Decl_Fn *fn, Alloc *alloc) {
+    *g = (Graph){.fn = fn, .alloc = alloc};
+    flattenList(g, &fn->stmtv, &fn->stmtc, NONE);
+    resolveGotos(g);
+    linkNodes(g);
+    findDominators(g);
+
+    for (size_t i = 0; i < fn->argc; i++)
+        addVar(g, fn->argv[i].name, isIntType(fn->argv[i].type), NONE);
+    for (size_t i = 0; i < g->len; i++) {
+        const Ast_Stmt *s = g->nodes[i].stmt;
+        if (s->type == Stmt_decl)
+            addVar(g, s->decl->name, isIntType(s->decl->type), i);
+    }
+    for (size_t i = 0; i < g->len; i++) {
+        Ast_Expr *exprs[2];
+        size_t n = nodeExprs(&g->nodes[i], exprs);
+        for (size_t k = 0; k < n; k++)
+            markAddrTaken(g, exprs[k]);
+    }
+}
+
+static void freeGraph(Graph *g) {
+    free(g->nodes);
+    free(g->succs);
+    free(g->predStart);
+    free(g->predv);
+    free(g->idom);
+    free(g->rpoNum);
+    free(g->vars);
+}
+
+static bool nameUsed(Graph *g, const char *name) {
+    if (findVar(g, name) != NULL)
+        return true;
+    for (size_t i = 0; i < g->len; i++) {
+        Ast_Expr *exprs[2];
+        size_t n = nodeExprs(&g->nodes[i], exprs);
+        for (size_t k = 0; k < n; k++) {
+            if (mentions(exprs[k], name))
+                return true;
+        }
+    }
+    return false;
+}
+
+static char *freshName(Graph *g, const char *prefix) {
+    char name[32];
+    for (unsigned i = 0;; i++) {
+        snprintf(name, sizeof name, "%s%u", prefix, i);
+        if (!nameUsed(g, name))
+            break;
+    }
+    size_t len = strlen(name);
+    char *copy = newNode(g->alloc, len + 1);
+    memcpy(copy, name, len + 1);
+    return copy;
+}
+
+static Ast_Expr *newIdent(Alloc *alloc, char *name) {
+    Ast_Expr *e = newNode(alloc, sizeof(Ast_Expr));
+    *e = (Ast_Expr){.type = Expr_ident, .ident = name};
+    return e;
+}
+
+static Ast_Expr *newLit(Alloc *alloc, size_t n) {
+    Expr_Lit *lit = newNode(alloc, sizeof(Expr_Lit));
+    *lit = (Expr_Lit){.type = Lit_int, .integer = n};
+    Ast_Expr *e = newNode(alloc, sizeof(Ast_Expr));
+    *e = (Ast_Expr){.type = Expr_lit, .lit = lit};
+    return e;
+}
+
+static Ast_Expr *newBinOp(Alloc *alloc, int type, Ast_Expr *l,
+                          Ast_Expr *r) {
+    Expr_BinOp *bin = newNode(alloc, sizeof(Expr_BinOp));
+    *bin = (Expr_BinOp){.type = type, .left = l, .right = r};
+    Ast_Expr *e = newNode(alloc, sizeof(Ast_Expr));
+    *e = (Ast_Expr){.type = Expr_binOp, .binOp = bin};
+    return e;
+}
+
+// loops ///////////////////////////////////////////////////////////////////////
+
+typedef struct Temp {
+    char *name;
+    Ast_Expr *init;
+} Temp;
+
+// statements to insert into a list, before index `at`
+typedef struct Insert {
+    Ast_Stmt **listv;
+    size_t *listc;
+    size_t at;
+    Ast_Stmt *stmtv;
+    size_t stmtc;
+} Insert;
+
+typedef struct Loop {
+    Graph *g;
+    Loop_Stats *stats;
+    size_t header;
+    bool *body;
+
+    // names assigned or declared in the loop
+    const char **written;
+    size_t writtenc;
+    size_t writtenCapacity;
+
+    // declarations for the preheader, in order
+    Temp *temps;
+    size_t tempc;
+    size_t tempCapacity;
+
+    Insert *inserts;
+    size_t insertc;
+    size_t insertCapacity;
+} Loop;
+
+static bool isWritten(const Loop *l, const char *name) {
+    for (size_t i = 0; i < l->writtenc; i++) {
+        if (!strcmp(l->written[i], name))
+            return true;
+    }
+    return false;
+}
+
+// an int local in scope at the preheader: a parameter, or declared earlier
+// at the top of the function
+static bool usable(const Loop *l, const Var *v) {
+    const Graph *g = l->g;
+    if (!v->isInt || v->addrTaken || v->ambiguous)
+        return false;
+    return v->decl == NONE || (v->decl < l->header &&
+                               g->nodes[v->decl].listv == &g->fn->stmtv);
+}
+
+static bool invariantIdent(Loop *l, const char *name) {
+    const Var *v = findVar(l->g, name);
+    return v != NULL && usable(l, v) && !isWritten(l, name);
+}
+
+// int arithmetic that reads only invariant locals and cannot trap
+static bool invariant(Loop *l, const Ast_Expr *e, bool *reads) {
+    switch (e->type) {
+    case Expr_lit:
+        return e->lit->type == Lit_int;
+    case Expr_ident:
+        *reads = true;
+        return invariantIdent(l, e->ident);
+    case Expr_binOp: {
+        const Expr_BinOp *b = e->binOp;
+        switch (b->type) {
+        case BinOp_plus:
+        case BinOp_minus:
+        case BinOp_mul:
+        case BinOp_binAnd:
+        case BinOp_binOr:
+        case BinOp_xOr:
+            break;
+        case BinOp_div:
+            if (!isIntLit(b->right) || b->right->lit->integer == 0 ||
+                b->right->lit->integer == (size_t)-1)
+                return false;
+            break;
+        case BinOp_lShift:
+        case BinOp_rShift:
+            if (!isIntLit(b->right) || b->right->lit->integer >= 64)
+                return false;
+            break;
+        default:
+            return false;
+        }
+        return invariant(l, b->left, reads) && invariant(l, b->right, reads);
+    }
+    default:
+        return false;
+    }
+}
+
+// the preheader runs even when the code a temporary came from would not
+static void markWrapping(Ast_Expr *e) {
+    if (e->type != Expr_binOp)
+        return;
+    e->binOp->wraps = true;
+    markWrapping(e->binOp->left);
+    markWrapping(e->binOp->right);
+}
+
+// replaces `e` with a temporary initialized to it in the preheader, shared
+// with any equal expression already moved there
+static char *toTemp(Loop *l, Ast_Expr *e, const char *prefix) {
+    for (size_t i = 0; i < l->tempc; i++) {
+        if (exprEqual(l->temps[i].init, e)) {
+            *e = (Ast_Expr){.type = Expr_ident, .ident = l->temps[i].name};
+            return l->temps[i].name;
+        }
+    }
+
+    Graph *g = l->g;
+    Ast_Expr *init = newNode(g->alloc, sizeof(Ast_Expr));
+    *init = *e;
+    markWrapping(init);
+    char *name = freshName(g, prefix);
+    Var *v = addVar(g, name, true, NONE);
+    v->temp = true;
+
+    l->temps = grow(l->temps, &l->tempCapacity, l->tempc, sizeof(Temp));
+    l->temps[l->tempc++] = (Temp){.name = name, .init = init};
+    *e = (Ast_Expr){.type = Expr_ident, .ident = name};
+    return name;
+}
+
+static void hoistIn(Loop *l, Ast_Expr *e) {
+    bool reads = false;
+    if (e->type == Expr_binOp && invariant(l, e, &reads) && reads) {
+        size_t before = l->tempc;
+        toTemp(l, e, "_licm");
+        l->stats->hoisted += l->tempc - before;
+        return;
+    }
+
+    switch (e->type) {
+    case Expr_binOp:
+        hoistIn(l, e->binOp->left);
+        hoistIn(l, e->binOp->right);
+        break;
+    case Expr_fnCall:
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            hoistIn(l, &e->fnCall->argv[i]);
+        break;
+    case Expr_val:
+        hoistIn(l, e->val);
+        break;
+    case Expr_asType:
+        hoistIn(l, e->asType->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// strength reduction //////////////////////////////////////////////////////////
+
+typedef struct Induction {
+    const char *name;
+    // the only write to the variable in the loop: name = name +/- step
+    const Node *update;
+    size_t step;
+    bool down;
+
+    // updates for the reduced temporaries, after `update`
+    Ast_Stmt *stmtv;
+    size_t stmtc;
+    size_t stmtCapacity;
+} Induction;
+
+// matches `name = name +/- c` or `name = c + name`
+static bool isStep(const Ast_Stmt *s, const char *name, size_t *step,
+                   bool *down) {
+    if (s->type != Stmt_assign || s->assign->lvalue->type != Expr_ident ||
+        strcmp(s->assign->lvalue->ident, name) ||
+        s->assign->rvalue->type != Expr_binOp)
+        return false;
+
+    const Expr_BinOp *b = s->assign->rvalue->binOp;
+    const Ast_Expr *var = b->left, *c = b->right;
+    if (b->type == BinOp_plus && isIntLit(var)) {
+        var = b->right;
+        c = b->left;
+    }
+    if ((b->type != BinOp_plus && b->type != BinOp_minus) || !isIntLit(c) ||
+        var->type != Expr_ident || strcmp(var->ident, name))
+        return false;
+    *step = c->lit->integer;
+    *down = b->type == BinOp_minus;
+    return true;
+}
+
+static bool findInduction(Loop *l, const Var *v, Induction *ind) {
+    Graph *g = l->g;
+    *ind = (Induction){.name = v->name};
+    for (size_t i = 0; i < g->len; i++) {
+        if (!l->body[i])
+            continue;
+        const Ast_Stmt *s = g->nodes[i].stmt;
+        if (s->type == Stmt_decl && !strcmp(s->decl->name, v->name))
+            return false;
+        if (s->type != Stmt_assign || s->assign->lvalue->type != Expr_ident ||
+            strcmp(s->assign->lvalue->ident, v->name))
+            continue;
+        if (ind->update != NULL ||
+            !isStep(s, v->name, &ind->step, &ind->down))
+            return false;
+        ind->update = &g->nodes[i];
+    }
+    return ind->update != NULL && ind->update->listv != NULL;
+}
+
+static void addUpdate(Loop *l, Induction *ind, char *temp, Ast_Expr *step) {
+    Alloc *alloc = l->g->alloc;
+    Stmt_Assign *assign = newNode(alloc, sizeof(Stmt_Assign));
+    // the last update runs past the last value the loop used
+    *assign = (Stmt_Assign){
+        .lvalue = newIdent(alloc, temp),
+        .rvalue = newBinOp(alloc, ind->down ? BinOp_minus : BinOp_plus,
+                           newIdent(alloc, temp), step),
+    };
+    assign->rvalue->binOp->wraps = true;
+    ind->stmtv =
+        grow(ind->stmtv, &ind->stmtCapacity, ind->stmtc, sizeof(Ast_Stmt));
+    ind->stmtv[ind->stmtc++] = (Ast_Stmt){
+        .type = Stmt_assign,
+        .assign = assign,
+        .span = ind->update->stmt->span,
+    };
+}
+
+static void reduceIn(Loop *l, Induction *ind, Ast_Expr *e) {
+    switch (e->type) {
+    case Expr_binOp: {
+        Expr_BinOp *b = e->binOp;
+        Ast_Expr *k = NULL;
+        if (b->type == BinOp_mul && b->left->type == Expr_ident &&
+            !strcmp(b->left->ident, ind->name))
+            k = b->right;
+        else if (b->type == BinOp_mul && b->right->type == Expr_ident &&
+                 !strcmp(b->right->ident, ind->name))
+            k = b->left;
+        if (k != NULL && (isIntLit(k) || (k->type == Expr_ident &&
+                                          invariantIdent(l, k->ident)))) {
+            size_t before = l->tempc;
+            char *temp = toTemp(l, e, "_sr");
+            if (l->tempc == before)
+                return;
+            l->stats->reduced++;
+
+            // the temporary grows by step * k with the variable
+            Alloc *alloc = l->g->alloc;
+            Ast_Expr *step;
+            if (isIntLit(k)) {
+                step = newLit(alloc, ind->step * k->lit->integer);
+            } else if (ind->step == 1) {
+                step = newIdent(alloc, k->ident);
+            } else {
+                step = newBinOp(alloc, BinOp_mul, newIdent(alloc, k->ident),
+                                newLit(alloc, ind->step));
+                step = newIdent(alloc, toTemp(l, step, "_licm"));
+            }
+            addUpdate(l, ind, temp, step);
+            return;
+        }
+        reduceIn(l, ind, b->left);
+        reduceIn(l, ind, b->right);
+        break;
+    }
+    case Expr_fnCall:
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            reduceIn(l, ind, &e->fnCall->argv[i]);
+        break;
+    case Expr_val:
+        reduceIn(l, ind, e->val);
+        break;
+    case Expr_asType:
+        reduceIn(l, ind, e->asType->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// insertion ///////////////////////////////////////////////////////////////////
+
+static void addInsert(Loop *l, Insert ins) {
+    l->inserts =
+        grow(l->inserts, &l->insertCapacity, l->insertc, sizeof(Insert));
+    l->inserts[l->insertc++] = ins;
+}
+
+static void applyInsert(Alloc *alloc, const Insert *ins) {
+    size_t len = *ins->listc;
+    Ast_Stmt *old = *ins->listv;
+    Ast_Stmt *stmts = newNode(alloc, (len + ins->stmtc) * sizeof(Ast_Stmt));
+    memcpy(stmts, old, ins->at * sizeof(Ast_Stmt));
+    memcpy(stmts + ins->at, ins->stmtv, ins->stmtc * sizeof(Ast_Stmt));
+    memcpy(stmts + ins->at + ins->stmtc, old + ins->at,
+           (len - ins->at) * sizeof(Ast_Stmt));
+    *ins->listv = stmts;
+    *ins->listc = len + ins->stmtc;
+}
+
+// inserts into the same list from the back, so earlier indices hold
+static void applyInserts(Loop *l) {
+    while (l->insertc > 0) {
+        size_t last = 0;
+        for (size_t i = 1; i < l->insertc; i++) {
+            if (l->inserts[i].at > l->inserts[last].at)
+                last = i;
+        }
+        applyInsert(l->g->alloc, &l->inserts[last]);
+        free(l->inserts[last].stmtv);
+        l->inserts[last] = l->inserts[--l->insertc];
+    }
+}
+
+static void markBody(Loop *l) {
+    Graph *g = l->g;
+    size_t *stack = malloc(g->len * sizeof(size_t));
+    assert(stack != NULL);
+    size_t top = 0;
+
+    l->body[l->header] = true;
+    for (size_t k = g->predStart[l->header]; k < g->predStart[l->header + 1];
+         k++) {
+        size_t t = g->predv[k];
+        if (dominates(g, l->header, t) && !l->body[t]) {
+            l->body[t] = true;
+            stack[top++] = t;
+        }
+    }
+    while (top > 0) {
+        size_t v = stack[--top];
+        for (size_t k = g->predStart[v]; k < g->predStart[v + 1]; k++) {
+            size_t p = g->predv[k];
+            if (!l->body[p]) {
+                l->body[p] = true;
+                stack[top++] = p;
+            }
+        }
+    }
+    free(stack);
+}
+
+// whether node `i` is in the header's list after the header, or nested in
+// a statement that is, where declarations put before the header are in scope
+static bool inScope(const Loop *l, size_t i) {
+    const Graph *g = l->g;
+    const Node *h = &g->nodes[l->header];
+    for (; i != NONE; i = g->nodes[i].parent) {
+        if (g->nodes[i].listv == h->listv)
+            return g->nodes[i].index >= h->index;
+    }
+    return false;
+}
+
+// every entry from outside the loop falls through to the header, so code
+// placed just before it runs once per entry, and the whole body can see it
+static bool hasPreheader(const Loop *l) {
+    const Graph *g = l->g;
+    if (g->nodes[l->header].listv == NULL)
+        return false;
+    for (size_t k = g->predStart[l->header]; k < g->predStart[l->header + 1];
+         k++) {
+        size_t p = g->predv[k];
+        if (!l->body[p] && g->nodes[p].kind == Node_goto)
+            return false;
+    }
+    for (size_t i = 0; i < g->len; i++) {
+        if (l->body[i] && !inScope(l, i))
+            return false;
+    }
+    return true;
+}
+
+static void optimizeLoop(Graph *g, size_t header, Loop_Stats *stats) {
+    Loop l = {.g = g, .stats = stats, .header = header};
+    l.body = calloc(g->len, sizeof(bool));
+    assert(l.body != NULL);
+    markBody(&l);
+    if (!hasPreheader(&l))
+        goto done;
+
+    for (size_t i = 0; i < g->len; i++) {
+        const Ast_Stmt *s = g->nodes[i].stmt;
+        const char *name = NULL;
+        if (!l.body[i])
+            continue;
+        if (s->type == Stmt_decl)
+            name = s->decl->name;
+        else if (s->type == Stmt_assign &&
+                 s->assign->lvalue->type == Expr_ident)
+            name = s->assign->lvalue->ident;
+        if (name == NULL)
+            continue;
+        l.written = grow(l.written, &l.writtenCapacity, l.writtenc,
+                         sizeof(char *));
+        l.written[l.writtenc++] = name;
+    }
+
+    for (size_t i = 0; i < g->len; i++) {
+        Ast_Expr *exprs[2];
+        size_t n = l.body[i] ? nodeExprs(&g->nodes[i], exprs) : 0;
+        for (size_t k = 0; k < n; k++)
+            hoistIn(&l, exprs[k]);
+    }
+
+    for (size_t v = 0; v < g->varc; v++) {
+        const Var *var = &g->vars[v];
+        if (var->temp || !usable(&l, var))
+            continue;
+        Induction ind;
+        if (!findInduction(&l, var, &ind))
+            continue;
+        for (size_t i = 0; i < g->len; i++) {
+            Ast_Expr *exprs[2];
+            size_t n = l.body[i] ? nodeExprs(&g->nodes[i], exprs) : 0;
+            for (size_t k = 0; k < n; k++)
+                reduceIn(&l, &ind, exprs[k]);
+        }
+        if (ind.stmtc > 0) {
+            addInsert(&l, (Insert){.listv = ind.update->listv,
+                                   .listc = ind.update->listc,
+                                   .at = ind.update->index + 1,
+                                   .stmtv = ind.stmtv,
+                                   .stmtc = ind.stmtc});
+        }
+    }
+
+    if (l.tempc > 0) {
+        const Node *h = &g->nodes[header];
+        Ast_Stmt *decls = malloc(l.tempc * sizeof(Ast_Stmt));
+        assert(decls != NULL);
+        for (size_t i = 0; i < l.tempc; i++) {
+            Ast_TypeExpr *type = newNode(g->alloc, sizeof(Ast_TypeExpr));
+            *type = (Ast_TypeExpr){.type = TypeExpr_int};
+            Decl_Var *decl = newNode(g->alloc, sizeof(Decl_Var));
+            *decl = (Decl_Var){.name = l.temps[i].name,
+                               .type = type,
+                               .init = l.temps[i].init};
+            decls[i] = (Ast_Stmt){.type = Stmt_decl, .decl = decl,
+                                  .span = h->stmt->span};
+        }
+        addInsert(&l, (Insert){.listv = h->listv,
+                               .listc = h->listc,
+                               .at = h->index,
+                               .stmtv = decls,
+                               .stmtc = l.tempc});
+    }
+    applyInserts(&l);
+
+done:
+    free(l.body);
+    free(l.written);
+    free(l.temps);
+    free(l.inserts);
+}
+
+// redundant checks ////////////////////////////////////////////////////////////
+
+// a comparison known to hold, or known not to
+typedef struct Fact {
+    const Expr_BinOp *cond;
+    bool truth;
+} Fact;
+
+typedef struct Facts {
+    Fact *v;
+    size_t len;
+    size_t capacity;
+} Facts;
+
+// orderings a comparison allows, as bits for <, == and >
+static unsigned orderings(int op) {
+    switch (op) {
+    case BinOp_lt:
+        return 1;
+    case BinOp_ltEq:
+        return 3;
+    case BinOp_eq:
+        return 2;
+    case BinOp_gtEq:
+        return 6;
+    case BinOp_gt:
+        return 4;
+    case BinOp_nEq:
+        return 5;
+    default:
+        return 0;
+    }
+}
+
+// a literal, or a local that only changes by assignment
+static bool stable(Graph *g, const Ast_Expr *e) {
+    if (isIntLit(e))
+        return true;
+    if (e->type != Expr_ident)
+        return false;
+    const Var *v = findVar(g, e->ident);
+    return v != NULL && !v->addrTaken && !v->ambiguous;
+}
+
+static void addFacts(Graph *g, Facts *facts, const Ast_Expr *cond,
+                     bool truth) {
+    if (cond->type != Expr_binOp)
+        return;
+    const Expr_BinOp *b = cond->binOp;
+    if ((b->type == BinOp_boolAnd && truth) ||
+        (b->type == BinOp_boolOr && !truth)) {
+        addFacts(g, facts, b->left, truth);
+        addFacts(g, facts, b->right, truth);
+        return;
+    }
+    if (orderings(b->type) == 0 || !stable(g, b->left) ||
+        !stable(g, b->right))
+        return;
+    facts->v = grow(facts->v, &facts->capacity, facts->len, sizeof(Fact));
+    facts->v[facts->len++] = (Fact){.cond = b, .truth = truth};
+}
+
+static void kill(Facts *facts, const char *name) {
+    for (size_t i = 0; i < facts->len;) {
+        const Expr_BinOp *b = facts->v[i].cond;
+        if (mentions(b->left, name) || mentions(b->right, name))
+            facts->v[i] = facts->v[--facts->len];
+        else
+            i++;
+    }
+}
+
+// whether the facts decide `cond`, and which way
+static bool decide(const Facts *facts, const Ast_Expr *cond, bool *value) {
+    if (cond->type != Expr_binOp || orderings(cond->binOp->type) == 0)
+        return false;
+    const Expr_BinOp *b = cond->binOp;
+    unsigned want = orderings(b->type);
+    // the same comparison with the operands swapped
+    unsigned swapped = (want & 2) | (want & 1) << 2 | (want & 4) >> 2;
+
+    for (size_t i = 0; i < facts->len; i++) {
+        const Expr_BinOp *f = facts->v[i].cond;
+        unsigned known = orderings(f->type);
+        if (!facts->v[i].truth)
+            known = ~known & 7;
+
+        unsigned other;
+        if (exprEqual(f->left, b->left) && exprEqual(f->right, b->right))
+            other = want;
+        else if (exprEqual(f->left, b->right) && exprEqual(f->right, b->left))
+            other = swapped;
+        else
+            continue;
+
+        if ((known & ~other) == 0) {
+            *value = true;
+            return true;
+        }
+        if ((known & other) == 0) {
+            *value = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+// kills the facts about anything `stmts` assign. returns true if they hold a
+// label, which control can reach from anywhere.
+static bool killWrites(Facts *facts, const Ast_Stmt *stmtv, size_t stmtc) {
+    bool label = false;
+    for (size_t i = 0; i < stmtc; i++) {
+        const Ast_Stmt *s = &stmtv[i];
+        if (s->type == Stmt_label) {
+            label = true;
+            if (s->label->stmt != NULL)
+                killWrites(facts, s->label->stmt, 1);
+        } else if (s->type == Stmt_decl) {
+            kill(facts, s->decl->name);
+        } else if (s->type == Stmt_assign &&
+                   s->assign->lvalue->type == Expr_ident) {
+            kill(facts, s->assign->lvalue->ident);
+        } else if (s->type == Stmt_if) {
+            label |= killWrites(facts, s->if_stmt->stmtv, s->if_stmt->stmtc);
+        }
+    }
+    return label;
+}
+
+static void checkList(Graph *g, Facts *facts, Ast_Stmt *stmtv, size_t stmtc,
+                      Loop_Stats *stats);
+
+static void checkStmt(Graph *g, Facts *facts, Ast_Stmt *s,
+                      Loop_Stats *stats) {
+    switch (s->type) {
+    case Stmt_label:
+        facts->len = 0;
+        if (s->label->stmt != NULL)
+            checkStmt(g, facts, s->label->stmt, stats);
+        break;
+    case Stmt_decl:
+        kill(facts, s->decl->name);
+        break;
+    case Stmt_assign:
+        if (s->assign->lvalue->type == Expr_ident)
+            kill(facts, s->assign->lvalue->ident);
+        break;
+    case Stmt_if: {
+        Stmt_If *ifs = s->if_stmt;
+        bool value;
+        if (decide(facts, ifs->cond, &value)) {
+            Expr_Lit *lit = newNode(g->alloc, sizeof(Expr_Lit));
+            *lit = (Expr_Lit){.type = Lit_bool, .boolean = value};
+            ifs->cond = newNode(g->alloc, sizeof(Ast_Expr));
+            *ifs->cond = (Ast_Expr){.type = Expr_lit, .lit = lit};
+            stats->checks++;
+        }
+
+        Facts inner = {.len = facts->len, .capacity = facts->len};
+        inner.v = malloc((facts->len + 1) * sizeof(Fact));
+        assert(inner.v != NULL);
+        if (facts->len > 0)
+            memcpy(inner.v, facts->v, facts->len * sizeof(Fact));
+        addFacts(g, &inner, ifs->cond, true);
+        checkList(g, &inner, ifs->stmtv, ifs->stmtc, stats);
+        free(inner.v);
+
+        const Ast_Stmt *last = ifs->stmtc ? &ifs->stmtv[ifs->stmtc - 1] : NULL;
+        bool leaves = last != NULL && (last->type == Stmt_goto ||
+                                       last->type == Stmt_return);
+        if (killWrites(facts, ifs->stmtv, ifs->stmtc))
+            facts->len = 0;
+        else if (leaves)
+            addFacts(g, facts, ifs->cond, false);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void checkList(Graph *g, Facts *facts, Ast_Stmt *stmtv, size_t stmtc,
+                      Loop_Stats *stats) {
+    for (size_t i = 0; i < stmtc; i++)
+        checkStmt(g, facts, &stmtv[i], stats);
+}
+
+// pass ////////////////////////////////////////////////////////////////////////
+
+Loop_Stats Loop_optimizeFn(Decl_Fn *fn, Alloc *alloc) {
+    assert(!fn->body_pending);
+    if (alloc == NULL)
+        alloc = &mAlloc;
+    Loop_Stats stats = {0};
+
+    // one loop at a time, rebuilding the graph after each has changed the
+    // statement lists. labels are kept by pointer, which the lists do not
+    // own.
+    const Stmt_Label **done = NULL;
+    size_t donec = 0, doneCapacity = 0;
+    for (;;) {
+        Graph g;
+        buildGraph(&g, fn, alloc);
+
+        size_t header = NONE;
+        for (size_t t = 0; t < g.len && header == NONE; t++) {
+            for (int k = 0; k < 2; k++) {
+                size_t h = g.succs[t][k];
+                if (h == NONE || g.nodes[h].kind != Node_label ||
+                    !dominates(&g, h, t))
+                    continue;
+                bool seen = false;
+                for (size_t i = 0; i < donec && !seen; i++)
+                    seen = done[i] == g.nodes[h].stmt->label;
+                if (!seen) {
+                    header = h;
+                    break;
+                }
+            }
+        }
+
+        if (header != NONE) {
+            done = grow(done, &doneCapacity, donec, sizeof(Stmt_Label *));
+            done[donec++] = g.nodes[header].stmt->label;
+            stats.loops++;
+            optimizeLoop(&g, header, &stats);
+        }
+        freeGraph(&g);
+        if (header == NONE)
+            break;
+    }
+    free(done);
+
+    Graph g;
+    buildGraph(&g, fn, alloc);
+    Facts facts = {0};
+    checkList(&g, &facts, fn->stmtv, fn->stmtc, &stats);
+    free(facts.v);
+    freeGraph(&g);
+    return stats;
+}
+
+Loop_Stats Loop_optimizeModule(Ast_Module *m, Alloc *alloc) {
+    Loop_Stats stats = {0};
+    for (size_t i = 0; i < m->declc; i++) {
+        if (m->declv[i].type != Decl_fn)
+            continue;
+        Loop_Stats fn = Loop_optimizeFn(&m->declv[i].fn, alloc);
+        stats.loops += fn.loops;
+        stats.hoisted += fn.hoisted;
+        stats.reduced += fn.reduced;
+        stats.checks += fn.checks;
+    }
+    return stats;
+}
+
+#ifdef TESTING
+
+#include "../cgen.h"
+#include "../parser.h"
+#include <stdio.h>
+
+static char arena[1 << 16];
+static FixedBuf fb;
+static Alloc fba;
+
+static void parse(const char *src, Ast_Module *m) {
+    TokBuf toks;
+    TokBuf_init(&toks);
+    assert(TokBuf_lex(&toks, src, strlen(src), 1));
+    Parser p;
+    assert(Parser_initTokBuf(&p, "l.l1", src, strlen(src), &toks, false));
+    fb = (FixedBuf){.data = arena, .capacity = sizeof arena};
+    fba = Alloc_fromFixedBuf(&fb);
+    p.alloc = &fba;
+    assert(Parser_parseModule(&p, m));
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+}
+
+// the function as C, after the prototypes
+static char *emitted(const Ast_Module *m) {
+    static char buf[4096];
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(CGen_emitModule(m, f, NULL));
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof buf - 1, f);
+    buf[n] = 0;
+    fclose(f);
+    return strstr(buf, ") {\n") + 4;
+}
+
+void test_loop() {
+    Ast_Module m;
+    parse("export fn _sum(_n: int, _k: int, _p: ptr int) int {\n"
+          "    var _i: int = 0;\n"
+          "    var _s: int = 0;\n"
+          "    _top: if (_i < _n) {\n"
+          "        if (_i < _n) { _s = _s + _i * 4; }\n"
+          "        val _p = _s + (_k * _n + 1);\n"
+          "        _s = _s - (1 + _n * _k);\n"
+          "        _i = _i + 2;\n"
+          "        _s = _s + _k * _i;\n"
+          "        goto _top;\n"
+          "    }\n"
+          "    return _s;\n"
+          "}\n",
+          &m);
+
+    Loop_Stats stats = Loop_optimizeModule(&m, &fba);
+    assert(stats.loops == 1);
+    assert(stats.hoisted == 2);
+    assert(stats.reduced == 2);
+    assert(stats.checks == 1);
+
+    // what runs ahead of the code it came from wraps instead of overflowing
+    const char *want =
+        "    int64_t l1_i = INT64_C(0);\n"
+        "    int64_t l1_s = INT64_C(0);\n"
+        "    int64_t l1_licm0 = (int64_t)(((uint64_t)l1_k * (uint64_t)l1_n)"
+        " + (uint64_t)INT64_C(1));\n"
+        "    int64_t l1_licm1 = (int64_t)((uint64_t)INT64_C(1)"
+        " + ((uint64_t)l1_n * (uint64_t)l1_k));\n"
+        "    int64_t l1_sr0 ="
+        " (int64_t)((uint64_t)l1_i * (uint64_t)INT64_C(4));\n"
+        "    int64_t l1_sr1 = (int64_t)((uint64_t)l1_k * (uint64_t)l1_i);\n"
+        "    int64_t l1_licm2 ="
+        " (int64_t)((uint64_t)l1_k * (uint64_t)INT64_C(2));\n"
+        "    l1_top:;\n"
+        "    if (l1_i < l1_n) {\n"
+        "        if (true) {\n"
+        "            l1_s = l1_s + l1_sr0;\n"
+        "        }\n"
+        "        *l1_p = l1_s + l1_licm0;\n"
+        "        l1_s = l1_s - l1_licm1;\n"
+        "        l1_i = l1_i + INT64_C(2);\n"
+        "        l1_sr0 ="
+        " (int64_t)((uint64_t)l1_sr0 + (uint64_t)INT64_C(8));\n"
+        "        l1_sr1 = (int64_t)((uint64_t)l1_sr1 + (uint64_t)l1_licm2);\n"
+        "        l1_s = l1_s + l1_sr1;\n"
+        "        goto l1_top;\n"
+        "    }\n"
+        "    return l1_s;\n"
+        "}\n";
+    assert(!strcmp(emitted(&m), want));
+}
+
+void test_exit_test() {
+    // the guard at the top leaves the loop, so it is false below it
+    Ast_Module m;
+    parse("fn _g(_n: int) int {\n"
+          "    var _i: int = 0;\n"
+          "    _top: if (_i >= _n) { return _i; }\n"
+          "    if (_n > _i) { _i = _i + 3; }\n"
+          "    if (_i < _n) { return 0; }\n"
+          "    goto _top;\n"
+          "}\n",
+          &m);
+
+    Loop_Stats stats = Loop_optimizeFn(&m.declv[0].fn, &fba);
+    assert(stats.loops == 1);
+    assert(stats.hoisted == 0 && stats.reduced == 0);
+    // `_i` changes in between, so only the first check goes
+    assert(stats.checks == 1);
+    const Ast_Stmt *stmts = m.declv[0].fn.stmtv;
+    assert(stmts[2].if_stmt->cond->type == Expr_lit);
+    assert(stmts[2].if_stmt->cond->lit->boolean);
+    assert(stmts[3].if_stmt->cond->type == Expr_binOp);
+}
+
+void test_no_preheader() {
+    // `_top` is only reached through `_mid`, so `_mid` heads the loop. it is
+    // entered by a `goto`, so nothing can be placed in front of it.
+    Ast_Module m;
+    parse("fn _h(_n: int, _k: int) int {\n"
+          "    var _i: int = 0;\n"
+          "    goto _mid;\n"
+          "    _top: _i = _i + _n * _k;\n"
+          "    _mid: if (_i < 100) { goto _top; }\n"
+          "    return _i;\n"
+          "}\n",
+          &m);
+
+    Loop_Stats stats = Loop_optimizeFn(&m.declv[0].fn, &fba);
+    assert(stats.loops == 1);
+    assert(stats.hoisted == 0 && stats.reduced == 0);
+    assert(m.declv[0].fn.stmtc == 5);
+}
+
+void test_nested_header() {
+    // the loop leaves the block `_top` is in, so temporaries declared in
+    // front of it would be out of scope at `_more`
+    Ast_Module m;
+    parse("export fn _g(_c: bool, _k: int, _n: int) int {\n"
+          "    var _s: int = 0;\n"
+          "    if (_c) {\n"
+          "        _top: _s = _s + 1;\n"
+          "        goto _more;\n"
+          "    }\n"
+          "    return 0;\n"
+          "    _more: _s = _s + _k * _n;\n"
+          "    if (_s < 100) { goto _top; }\n"
+          "    return _s;\n"
+          "}\n",
+          &m);
+
+    Loop_Stats stats = Loop_optimizeFn(&m.declv[0].fn, &fba);
+    assert(stats.loops == 1);
+    assert(stats.hoisted == 0 && stats.reduced == 0);
+    assert(strstr(emitted(&m), "l1_licm") == NULL);
+}
+
+int main() {
+    printf("loop optimize...");
+    test_loop();
+    printf("OK!\n");
+    printf("loop exit test...");
+    test_exit_test();
+    printf("OK!\n");
+    printf("loop no preheader...");
+    test_no_preheader();
+    printf("OK!\n");
+    printf("loop nested header...");
+    test_nested_header();
+    printf("OK!\n");
+}
+
+#endif
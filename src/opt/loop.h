@@ -0,0 +1,53 @@
+// loop optimization. lang1 has no loop statement, so loops are found as
+// natural loops: a label that dominates a statement jumping back to it,
+// whether by `goto` or by falling through.
+//
+//   _top: if (_i < _n) { _s = _s + _i * 4 + _k * _n; _i = _i + 1; goto _top; }
+//
+// becomes, with the temporaries declared just before the label,
+//
+//   var _licm0: int = _k * _n;
+//   var _sr0: int = _i * 4;
+//   _top: if (_i < _n) {
+//       _s = _s + _sr0 + _licm0; _i = _i + 1; _sr0 = _sr0 + 4; goto _top;
+//   }
+
+#pragma once
+
+#include "../ast.h"
+#include "../common/mem/alloc.h"
+#include <stddef.h>
+
+typedef struct Loop_Stats {
+    size_t loops;
+    // loop-invariant expressions moved out of loops
+    size_t hoisted;
+    // multiplies of an induction variable turned into additions
+    size_t reduced;
+    // `if` conditions already decided by an enclosing or earlier guard
+    size_t checks;
+} Loop_Stats;
+
+// optimizes the loops of `fn`:
+//
+// - int arithmetic that only reads locals not written in the loop is
+//   computed once before the loop. only locals whose address is never
+//   taken count, and division only by a literal, so nothing hoisted can
+//   trap or see memory.
+// - `i * k`, where the loop's only write to `i` is `i = i +/- c` and `k`
+//   does not change, is kept in a temporary that grows by `c * k`.
+// - both run code the loop may not have, like the body of an `if` or a
+//   trip that never happens, so the arithmetic they add is marked to wrap
+//   on overflow.
+// - an `if` whose condition follows from one already tested, with neither
+//   side written in between, is given a literal condition.
+//
+// code is only moved into a loop's preheader when every entry from outside
+// falls through to the header label, never `goto`es it, and the loop stays
+// within the block the header is in. new nodes and grown statement lists
+// come from `alloc`, `mAlloc` if NULL; the lists they replace are left to
+// their owner.
+Loop_Stats Loop_optimizeFn(Decl_Fn *fn, Alloc *alloc);
+
+// runs `Loop_optimizeFn()` over every function in `m`.
+Loop_Stats Loop_optimizeModule(Ast_Module *m, Alloc *alloc);
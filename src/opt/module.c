@@ -0,0 +1,833 @@
+#include "module.h"
+#include "../ast.h"
+#include "../common/macros.h"
+#include "../common/mem/alloc.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// walking /////////////////////////////////////////////////////////////////////
+
+typedef void (*VisitFn)(void *ctx, Ast_Expr *e);
+
+// visits children before their parents, so a visitor may replace the node
+// it is given without the replacement being walked again
+static void walkExpr(Ast_Expr *e, VisitFn visit, void *ctx) {
+    switch (e->type) {
+    case Expr_binOp:
+        walkExpr(e->binOp->left, visit, ctx);
+        walkExpr(e->binOp->right, visit, ctx);
+        break;
+    case Expr_fnCall:
+        walkExpr(e->fnCall->head, visit, ctx);
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            walkExpr(&e->fnCall->argv[i], visit, ctx);
+        break;
+    case Expr_val:
+        walkExpr(e->val, visit, ctx);
+        break;
+    case Expr_asType:
+        walkExpr(e->asType->expr, visit, ctx);
+        break;
+    case Expr_ptr:
+    case Expr_ident:
+    case Expr_lit:
+        break;
+    }
+    visit(ctx, e);
+}
+
+static void walkStmts(Ast_Stmt *stmtv, size_t stmtc, VisitFn visit,
+                      void *ctx) {
+    for (size_t i = 0; i < stmtc; i++) {
+        Ast_Stmt *stmt = &stmtv[i];
+        while (stmt->type == Stmt_label && stmt->label->stmt != NULL)
+            stmt = stmt->label->stmt;
+
+        switch (stmt->type) {
+        case Stmt_decl:
+            if (stmt->decl->init != NULL)
+                walkExpr(stmt->decl->init, visit, ctx);
+            break;
+        case Stmt_assign:
+            walkExpr(stmt->assign->lvalue, visit, ctx);
+            walkExpr(stmt->assign->rvalue, visit, ctx);
+            break;
+        case Stmt_if:
+            walkExpr(stmt->if_stmt->cond, visit, ctx);
+            walkStmts(stmt->if_stmt->stmtv, stmt->if_stmt->stmtc, visit, ctx);
+            break;
+        case Stmt_return:
+            if (stmt->return_stmt != NULL)
+                walkExpr(stmt->return_stmt, visit, ctx);
+            break;
+        case Stmt_expr:
+            walkExpr(stmt->expr, visit, ctx);
+            break;
+        case Stmt_label:
+        case Stmt_goto:
+        case Stmt_break:
+            break;
+        }
+    }
+}
+
+static void walkDecl(Ast_Decl *d, VisitFn visit, void *ctx) {
+    if (d->type == Decl_fn)
+        walkStmts(d->fn.stmtv, d->fn.stmtc, visit, ctx);
+    else if (d->var.init != NULL)
+        walkExpr(d->var.init, visit, ctx);
+}
+
+// the name an expression refers to, if it refers to one
+static const char *refName(const Ast_Expr *e) {
+    if (e->type == Expr_ident)
+        return e->ident;
+    if (e->type == Expr_ptr)
+        return e->ptr;
+    return NULL;
+}
+
+// globals /////////////////////////////////////////////////////////////////////
+
+typedef struct Global {
+    Ast_Decl *decl;
+    const char *name;
+
+    bool reachable;
+    size_t callSites;
+
+    // the `return` expression of a function that may be inlined, and its
+    // size in nodes
+    Ast_Expr *body;
+    size_t cost;
+} Global;
+
+typedef struct Module {
+    Ast_Module *m;
+    Global *globals;
+
+    // open addressed table of `globals` indices plus one, 0 when empty
+    size_t *slots;
+    size_t mask;
+} Module;
+
+static size_t hashName(const char *name) {
+    size_t hash = 0xcbf29ce484222325u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+static Global *find(Module *mod, const char *name) {
+    for (size_t i = hashName(name) & mod->mask; mod->slots[i] != 0;
+         i = (i + 1) & mod->mask) {
+        Global *g = &mod->globals[mod->slots[i] - 1];
+        if (!strcmp(g->name, name))
+            return g;
+    }
+    return NULL;
+}
+
+static void indexModule(Module *mod, Ast_Module *m) {
+    size_t capacity = 16;
+    while (capacity < m->declc * 2)
+        capacity *= 2;
+
+    *mod = (Module){
+        .m = m,
+        .globals = calloc(m->declc + 1, sizeof(Global)),
+        .slots = calloc(capacity, sizeof(size_t)),
+        .mask = capacity - 1,
+    };
+    assert(mod->globals != NULL && mod->slots != NULL);
+
+    for (size_t i = 0; i < m->declc; i++) {
+        Ast_Decl *d = &m->declv[i];
+        assert(d->type != Decl_fn || !d->fn.body_pending);
+        Global *g = &mod->globals[i];
+        *g = (Global){
+            .decl = d,
+            .name = d->type == Decl_fn ? d->fn.name : d->var.name,
+        };
+
+        // on a duplicate name the first declaration wins
+        if (find(mod, g->name) != NULL)
+            continue;
+        size_t slot = hashName(g->name) & mod->mask;
+        while (mod->slots[slot] != 0)
+            slot = (slot + 1) & mod->mask;
+        mod->slots[slot] = i + 1;
+    }
+}
+
+static void freeModule(Module *mod) {
+    free(mod->globals);
+    free(mod->slots);
+}
+
+// dead declarations ///////////////////////////////////////////////////////////
+
+typedef struct Reach {
+    Module *mod;
+    Global **work;
+    size_t len;
+} Reach;
+
+static void markRef(void *ctx, Ast_Expr *e) {
+    Reach *r = ctx;
+    const char *name = refName(e);
+    Global *g = name != NULL ? find(r->mod, name) : NULL;
+    if (g != NULL && !g->reachable) {
+        g->reachable = true;
+        r->work[r->len++] = g;
+    }
+}
+
+static size_t dropUnreachable(Module *mod) {
+    Ast_Module *m = mod->m;
+    Reach r = {.mod = mod, .work = malloc((m->declc + 1) * sizeof(Global *))};
+    assert(r.work != NULL);
+
+    for (size_t i = 0; i < m->declc; i++) {
+        Global *g = &mod->globals[i];
+        g->reachable = g->decl->is_exported;
+        if (g->reachable)
+            r.work[r.len++] = g;
+    }
+
+    // names shadowed by locals are taken as references too, which only ever
+    // keeps more than needed
+    while (r.len > 0) {
+        Global *g = r.work[--r.len];
+        walkDecl(g->decl, markRef, &r);
+    }
+    free(r.work);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m->declc; i++) {
+        if (mod->globals[i].reachable)
+            m->declv[kept++] = m->declv[i];
+    }
+    size_t dropped = m->declc - kept;
+    m->declc = kept;
+    return dropped;
+}
+
+size_t ModuleOpt_dropUnreachable(Ast_Module *m) {
+    Module mod;
+    indexModule(&mod, m);
+    size_t dropped = dropUnreachable(&mod);
+    freeModule(&mod);
+    return dropped;
+}
+
+// inlining ////////////////////////////////////////////////////////////////////
+
+static void countCall(void *ctx, Ast_Expr *e) {
+    if (e->type != Expr_fnCall || e->fnCall->head->type != Expr_ident)
+        return;
+    Global *g = find(ctx, e->fnCall->head->ident);
+    if (g != NULL && g->decl->type == Decl_fn)
+        g->callSites++;
+}
+
+typedef struct Scan {
+    const char *name;
+    size_t count;
+    bool found;
+} Scan;
+
+static void countNodes(void *ctx, Ast_Expr *e) {
+    (void)e;
+    ((Scan *)ctx)->count++;
+}
+
+static void findCall(void *ctx, Ast_Expr *e) {
+    if (e->type == Expr_fnCall)
+        ((Scan *)ctx)->found = true;
+}
+
+static void countUses(void *ctx, Ast_Expr *e) {
+    Scan *s = ctx;
+    if (e->type == Expr_ident && !strcmp(e->ident, s->name))
+        s->count++;
+}
+
+static void findPtr(void *ctx, Ast_Expr *e) {
+    Scan *s = ctx;
+    if (e->type == Expr_ptr && !strcmp(e->ptr, s->name))
+        s->found = true;
+}
+
+static bool hasCall(Ast_Expr *e) {
+    Scan s = {0};
+    walkExpr(e, findCall, &s);
+    return s.found;
+}
+
+static size_t uses(Ast_Expr *e, const char *name) {
+    Scan s = {.name = name};
+    walkExpr(e, countUses, &s);
+    return s.count;
+}
+
+static int paramIndex(const Decl_Fn *fn, const char *name) {
+    for (size_t i = 0; i < fn->argc; i++) {
+        if (!strcmp(fn->argv[i].name, name))
+            return (int)i;
+    }
+    return -1;
+}
+
+static void findCandidates(Module *mod, const ModuleOpt_Config *cfg) {
+    for (size_t i = 0; i < mod->m->declc; i++) {
+        Global *g = &mod->globals[i];
+        g->body = NULL;
+        if (g->decl->type != Decl_fn || g->decl->is_exported)
+            continue;
+
+        Decl_Fn *fn = &g->decl->fn;
+        if (fn->stmtc != 1 || fn->stmtv[0].type != Stmt_return ||
+            fn->stmtv[0].return_stmt == NULL)
+            continue;
+        Ast_Expr *body = fn->stmtv[0].return_stmt;
+
+        // a pointer to a parameter would point into the caller once inlined
+        bool paramAddr = false;
+        for (size_t p = 0; p < fn->argc && !paramAddr; p++) {
+            Scan s = {.name = fn->argv[p].name};
+            walkExpr(body, findPtr, &s);
+            paramAddr = s.found;
+        }
+        if (paramAddr)
+            continue;
+
+        size_t maxCost = cfg->inlineCost;
+        if (cfg->profile != NULL && cfg->hotInlineCost > maxCost)
+            maxCost = cfg->hotInlineCost;
+
+        Scan size = {0};
+        walkExpr(body, countNodes, &size);
+        if (size.count <= maxCost || g->callSites == 1) {
+            g->body = body;
+            g->cost = size.count;
+        }
+    }
+}
+
+typedef struct Local {
+    const char *name;
+    bool addrTaken;
+} Local;
+
+typedef struct Site {
+    Module *mod;
+    const ModuleOpt_Config *cfg;
+    Alloc *alloc;
+    Global *caller;
+
+    // parameters and variables of the caller
+    Local *locals;
+    size_t len;
+    size_t capacity;
+
+    size_t inlined;
+} Site;
+
+static Local *findLocal(Site *s, const char *name) {
+    for (size_t i = 0; i < s->len; i++) {
+        if (!strcmp(s->locals[i].name, name))
+            return &s->locals[i];
+    }
+    return NULL;
+}
+
+static void addLocal(Site *s, const char *name) {
+    if (s->len == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 16;
+        s->locals = realloc(s->locals, s->capacity * sizeof(Local));
+        assert(s->locals != NULL);
+    }
+    s->locals[s->len++] = (Local){.name = name};
+}
+
+static void collectLocals(Site *s, Ast_Stmt *stmtv, size_t stmtc) {
+    for (size_t i = 0; i < stmtc; i++) {
+        Ast_Stmt *stmt = &stmtv[i];
+        while (stmt->type == Stmt_label && stmt->label->stmt != NULL)
+            stmt = stmt->label->stmt;
+        if (stmt->type == Stmt_decl)
+            addLocal(s, stmt->decl->name);
+        else if (stmt->type == Stmt_if)
+            collectLocals(s, stmt->if_stmt->stmtv, stmt->if_stmt->stmtc);
+    }
+}
+
+static void markAddrTaken(void *ctx, Ast_Expr *e) {
+    if (e->type != Expr_ptr)
+        return;
+    Local *l = findLocal(ctx, e->ptr);
+    if (l != NULL)
+        l->addrTaken = true;
+}
+
+typedef struct Capture {
+    Site *site;
+    const Decl_Fn *callee;
+    bool found;
+} Capture;
+
+// a global the callee refers to that a caller local would shadow
+static void findCapture(void *ctx, Ast_Expr *e) {
+    Capture *c = ctx;
+    const char *name = refName(e);
+    if (name != NULL && paramIndex(c->callee, name) < 0 &&
+        findLocal(c->site, name) != NULL)
+        c->found = true;
+}
+
+static bool canInline(Site *s, const Decl_Fn *callee, Ast_Expr *body,
+                      Expr_FnCall *call) {
+    if (callee->argc != call->argc)
+        return false;
+
+    Capture c = {.site = s, .callee = callee};
+    walkExpr(body, findCapture, &c);
+    if (c.found)
+        return false;
+
+    // arguments are evaluated where the parameter is used, so anything more
+    // than a literal must not be able to observe the move
+    bool bodyCalls = hasCall(body);
+    for (size_t i = 0; i < call->argc; i++) {
+        Ast_Expr *arg = &call->argv[i];
+        if (arg->type == Expr_lit)
+            continue;
+
+        if (arg->type == Expr_ident) {
+            // calls in the body could change anything reachable from memory
+            Local *l = findLocal(s, arg->ident);
+            if (bodyCalls && (l == NULL || l->addrTaken))
+                return false;
+            continue;
+        }
+
+        if (bodyCalls || hasCall(arg) || uses(body, callee->argv[i].name) > 1)
+            return false;
+    }
+    return true;
+}
+
+typedef struct Subst {
+    Alloc *alloc;
+    // NULL when copying an argument, whose names belong to the caller
+    const Decl_Fn *callee;
+    Ast_Expr *argv;
+} Subst;
+
+static void *newNode(Alloc *alloc, size_t size) {
+    void *node = Mem_alloc(alloc, size);
+    assert(node != NULL);
+    return node;
+}
+
+static void copyInto(const Subst *s, const Ast_Expr *e, Ast_Expr *out) {
+    if (s->callee != NULL && e->type == Expr_ident) {
+        int p = paramIndex(s->callee, e->ident);
+        if (p >= 0) {
+            Subst arg = {.alloc = s->alloc};
+            copyInto(&arg, &s->argv[p], out);
+            return;
+        }
+    }
+
+    *out = *e;
+    switch (e->type) {
+    case Expr_binOp:
+        out->binOp = newNode(s->alloc, sizeof(Expr_BinOp));
+        out->binOp->type = e->binOp->type;
+        out->binOp->wraps = e->binOp->wraps;
+        out->binOp->left = newNode(s->alloc, sizeof(Ast_Expr));
+        out->binOp->right = newNode(s->alloc, sizeof(Ast_Expr));
+        copyInto(s, e->binOp->left, out->binOp->left);
+        copyInto(s, e->binOp->right, out->binOp->right);
+        break;
+    case Expr_fnCall:
+        out->fnCall = newNode(s->alloc, sizeof(Expr_FnCall));
+        out->fnCall->argc = e->fnCall->argc;
+        out->fnCall->span = e->fnCall->span;
+        out->fnCall->head = newNode(s->alloc, sizeof(Ast_Expr));
+        copyInto(s, e->fnCall->head, out->fnCall->head);
+        out->fnCall->argv =
+            e->fnCall->argc == 0
+                ? NULL
+                : newNode(s->alloc, e->fnCall->argc * sizeof(Ast_Expr));
+        for (size_t i = 0; i < e->fnCall->argc; i++)
+            copyInto(s, &e->fnCall->argv[i], &out->fnCall->argv[i]);
+        break;
+    case Expr_val:
+        out->val = newNode(s->alloc, sizeof(Ast_Expr));
+        copyInto(s, e->val, out->val);
+        break;
+    case Expr_asType:
+        out->asType = newNode(s->alloc, sizeof(Expr_AsType));
+        out->asType->type = e->asType->type;
+        out->asType->expr = newNode(s->alloc, sizeof(Ast_Expr));
+        copyInto(s, e->asType->expr, out->asType->expr);
+        break;
+    case Expr_ptr:
+    case Expr_ident:
+    case Expr_lit:
+        // names, literals and types are never modified, so they are shared
+        break;
+    }
+}
+
+static void inlineCall(void *ctx, Ast_Expr *e) {
+    Site *s = ctx;
+    if (e->type != Expr_fnCall || e->fnCall->head->type != Expr_ident)
+        return;
+
+    const char *name = e->fnCall->head->ident;
+    if (findLocal(s, name) != NULL)
+        return;
+    Global *g = find(s->mod, name);
+    if (g == NULL || g->body == NULL || g == s->caller)
+        return;
+
+    // past the normal budget only hot call sites inline
+    const ModuleOpt_Config *cfg = s->cfg;
+    if (g->cost > cfg->inlineCost && g->callSites != 1 &&
+        (cfg->profile == NULL ||
+         Pgo_count(cfg->profile, Pgo_call, &e->fnCall->span) < cfg->hotCalls))
+        return;
+
+    Decl_Fn *callee = &g->decl->fn;
+    if (!canInline(s, callee, g->body, e->fnCall))
+        return;
+
+    Subst subst = {.alloc = s->alloc, .callee = callee,
+                   .argv = e->fnCall->argv};
+    Ast_Expr result;
+    copyInto(&subst, g->body, &result);
+    *e = result;
+    s->inlined++;
+}
+
+static size_t inlineRound(Module *mod, const ModuleOpt_Config *cfg,
+                          Alloc *alloc) {
+    for (size_t i = 0; i < mod->m->declc; i++)
+        mod->globals[i].callSites = 0;
+    for (size_t i = 0; i < mod->m->declc; i++)
+        walkDecl(&mod->m->declv[i], countCall, mod);
+    findCandidates(mod, cfg);
+
+    Site s = {.mod = mod, .cfg = cfg, .alloc = alloc};
+    for (size_t i = 0; i < mod->m->declc; i++) {
+        Global *g = &mod->globals[i];
+        s.caller = g;
+        s.len = 0;
+        if (g->decl->type == Decl_fn) {
+            Decl_Fn *fn = &g->decl->fn;
+            for (size_t p = 0; p < fn->argc; p++)
+                addLocal(&s, fn->argv[p].name);
+            collectLocals(&s, fn->stmtv, fn->stmtc);
+            walkStmts(fn->stmtv, fn->stmtc, markAddrTaken, &s);
+        }
+        walkDecl(g->decl, inlineCall, &s);
+    }
+
+    free(s.locals);
+    return s.inlined;
+}
+
+ModuleOpt_Stats ModuleOpt_run(Ast_Module *m, const ModuleOpt_Config *cfg) {
+    ModuleOpt_Config defaults = {
+        .inlineCost = MODULEOPT_DEFAULT_COST,
+        .inlineRounds = MODULEOPT_DEFAULT_ROUNDS,
+    };
+    if (cfg == NULL)
+        cfg = &defaults;
+
+    // a hot threshold of 0 would make every call site hot
+    ModuleOpt_Config tuned = *cfg;
+    if (tuned.hotCalls == 0)
+        tuned.hotCalls = MODULEOPT_DEFAULT_HOT_CALLS;
+    if (tuned.hotInlineCost == 0)
+        tuned.hotInlineCost = MODULEOPT_DEFAULT_HOT_COST;
+    cfg = &tuned;
+    Alloc *alloc = cfg->alloc != NULL ? cfg->alloc : &mAlloc;
+
+    Module mod;
+    indexModule(&mod, m);
+
+    ModuleOpt_Stats stats = {0};
+    for (unsigned round = 0; round < cfg->inlineRounds; round++) {
+        size_t inlined = inlineRound(&mod, cfg, alloc);
+        stats.inlined += inlined;
+        if (inlined == 0)
+            break;
+    }
+
+    stats.dropped = dropUnreachable(&mod);
+    freeModule(&mod);
+    return stats;
+}
+
+#ifdef TESTING
+
+#include "../parser.h"
+#include <stdio.h>
+
+// tests build their trees out of static pools, nothing is freed
+static Ast_Expr exprs[128];
+static size_t nexprs;
+static Expr_BinOp binOps[32];
+static size_t nbinOps;
+static Expr_FnCall calls[16];
+static size_t ncalls;
+static Expr_Lit lits[16];
+static size_t nlits;
+
+static char arena[4096];
+
+static Ast_Expr *newExpr(Ast_Expr e) {
+    assert(nexprs < sizeof exprs / sizeof *exprs);
+    exprs[nexprs] = e;
+    return &exprs[nexprs++];
+}
+
+static Ast_Expr *ident(char *name) {
+    return newExpr((Ast_Expr){.type = Expr_ident, .ident = name});
+}
+static Ast_Expr *lit(size_t n) {
+    lits[nlits] = (Expr_Lit){.type = Lit_int, .integer = n};
+    return newExpr((Ast_Expr){.type = Expr_lit, .lit = &lits[nlits++]});
+}
+static Ast_Expr *plus(Ast_Expr *l, Ast_Expr *r) {
+    binOps[nbinOps] = (Expr_BinOp){.type = BinOp_plus, .left = l, .right = r};
+    return newExpr((Ast_Expr){.type = Expr_binOp, .binOp = &binOps[nbinOps++]});
+}
+static Ast_Expr *call(char *fn, size_t argc, Ast_Expr *argv) {
+    calls[ncalls] =
+        (Expr_FnCall){.head = ident(fn), .argc = argc, .argv = argv};
+    return newExpr((Ast_Expr){.type = Expr_fnCall, .fnCall = &calls[ncalls++]});
+}
+
+static Ast_Decl fnDecl(char *name, bool exported, size_t argc, Decl_Var *argv,
+                       Ast_Stmt *body) {
+    return (Ast_Decl){
+        .type = Decl_fn,
+        .is_exported = exported,
+        .fn = {.name = name, .argc = argc, .argv = argv, .stmtc = 1,
+               .stmtv = body},
+    };
+}
+
+static Ast_Decl varDecl(char *name, Ast_Expr *init) {
+    return (Ast_Decl){.type = Decl_var, .var = {.name = name, .init = init}};
+}
+
+void test_inline_and_drop() {
+    // fn _twice(_a: int) int { return _a + _a; }
+    // fn _unused() int { return 1; }
+    // var _g: int = 3;
+    // var _dead: int = 4;
+    // export fn _main(_x: int) int { return _twice(_x) + _g; }
+    Decl_Var twiceArgs[] = {{.name = "_a"}};
+    Decl_Var mainArgs[] = {{.name = "_x"}};
+    Ast_Stmt twiceBody = {.type = Stmt_return,
+                          .return_stmt = plus(ident("_a"), ident("_a"))};
+    Ast_Stmt unusedBody = {.type = Stmt_return, .return_stmt = lit(1)};
+    Ast_Stmt mainBody = {
+        .type = Stmt_return,
+        .return_stmt = plus(call("_twice", 1, ident("_x")), ident("_g"))};
+
+    Ast_Decl decls[] = {
+        fnDecl("_twice", false, 1, twiceArgs, &twiceBody),
+        fnDecl("_unused", false, 0, NULL, &unusedBody),
+        varDecl("_g", lit(3)),
+        varDecl("_dead", lit(4)),
+        fnDecl("_main", true, 1, mainArgs, &mainBody),
+    };
+    Ast_Module m = {.declc = 5, .declv = decls};
+
+    FixedBuf fb = {.data = arena, .capacity = sizeof arena};
+    Alloc fba = Alloc_fromFixedBuf(&fb);
+    ModuleOpt_Config cfg = {.inlineCost = 8, .inlineRounds = 2,
+                            .alloc = &fba};
+
+    ModuleOpt_Stats stats = ModuleOpt_run(&m, &cfg);
+    assert(stats.inlined == 1);
+    assert(stats.dropped == 3);
+    assert(m.declc == 2);
+    assert(!strcmp(m.declv[0].var.name, "_g"));
+    assert(!strcmp(m.declv[1].fn.name, "_main"));
+
+    // return (_x + _x) + _g
+    Expr_BinOp *ret = mainBody.return_stmt->binOp;
+    assert(ret->left->type == Expr_binOp);
+    assert(!strcmp(ret->left->binOp->left->ident, "_x"));
+    assert(!strcmp(ret->left->binOp->right->ident, "_x"));
+}
+
+void test_not_inlined() {
+    // fn _twice(_a: int) int { return _a + _a; }
+    // fn _getG() int { return _g; }
+    // fn _h(_a: int) int { return _a; }
+    // var _g: int = 3;
+    // export fn _main() int {
+    //   var _g: int = 1;
+    //   return _twice(_h(_g)) + _getG();
+    // }
+    Decl_Var twiceArgs[] = {{.name = "_a"}};
+    Decl_Var hArgs[] = {{.name = "_a"}};
+    Decl_Var localG = {.name = "_g", .init = lit(1)};
+    Ast_Stmt twiceBody = {.type = Stmt_return,
+                          .return_stmt = plus(ident("_a"), ident("_a"))};
+    Ast_Stmt getGBody = {.type = Stmt_return, .return_stmt = ident("_g")};
+    Ast_Stmt hBody = {.type = Stmt_return, .return_stmt = ident("_a")};
+    Ast_Stmt mainBody[] = {
+        {.type = Stmt_decl, .decl = &localG},
+        {.type = Stmt_return,
+         .return_stmt = plus(call("_twice", 1, call("_h", 1, ident("_g"))),
+                             call("_getG", 0, NULL))},
+    };
+
+    Ast_Decl decls[] = {
+        fnDecl("_twice", false, 1, twiceArgs, &twiceBody),
+        fnDecl("_getG", false, 0, NULL, &getGBody),
+        fnDecl("_h", false, 1, hArgs, &hBody),
+        varDecl("_g", lit(3)),
+        fnDecl("_main", true, 0, NULL, mainBody),
+    };
+    decls[4].fn.stmtc = 2;
+    Ast_Module m = {.declc = 5, .declv = decls};
+
+    FixedBuf fb = {.data = arena, .capacity = sizeof arena};
+    Alloc fba = Alloc_fromFixedBuf(&fb);
+    ModuleOpt_Config cfg = {.inlineCost = 8, .inlineRounds = 1,
+                            .alloc = &fba};
+
+    // `_h(_g)` is inlined first, which leaves `_twice(_g)` to be inlined
+    // too. `_getG` refers to the global `_g`, which the local would shadow.
+    ModuleOpt_Stats stats = ModuleOpt_run(&m, &cfg);
+    assert(stats.inlined == 2);
+    assert(stats.dropped == 2);
+    assert(m.declc == 3);
+
+    Expr_BinOp *ret = mainBody[1].return_stmt->binOp;
+    assert(ret->left->type == Expr_binOp);
+    assert(!strcmp(ret->left->binOp->left->ident, "_g"));
+    assert(ret->right->type == Expr_fnCall);
+    assert(!strcmp(m.declv[0].fn.name, "_getG"));
+
+    // nothing left to do
+    stats = ModuleOpt_run(&m, &cfg);
+    assert(stats.inlined == 0 && stats.dropped == 0);
+}
+
+void test_hot_call() {
+    // fn _big(_a: int) int { return (_a + _a) + _a; }
+    // export fn _main(_x: int) int { return _big(_x) + _big(_x); }
+    // where only the first call is hot
+    Decl_Var bigArgs[] = {{.name = "_a"}};
+    Decl_Var mainArgs[] = {{.name = "_x"}};
+    Ast_Stmt bigBody = {
+        .type = Stmt_return,
+        .return_stmt = plus(plus(ident("_a"), ident("_a")), ident("_a"))};
+    Ast_Expr *hot = call("_big", 1, ident("_x"));
+    Ast_Expr *cold = call("_big", 1, ident("_x"));
+    hot->fnCall->span = (SrcSpan){.docName = "m.l1", .start = {.row = 2}};
+    cold->fnCall->span = (SrcSpan){.docName = "m.l1", .start = {.row = 3}};
+    Ast_Stmt mainBody = {.type = Stmt_return, .return_stmt = plus(hot, cold)};
+
+    Ast_Decl decls[] = {
+        fnDecl("_big", false, 1, bigArgs, &bigBody),
+        fnDecl("_main", true, 1, mainArgs, &mainBody),
+    };
+    Ast_Module m = {.declc = 2, .declv = decls};
+
+    Pgo_Profile profile;
+    Pgo_init(&profile);
+    Pgo_add(&profile, Pgo_call, &hot->fnCall->span, 5000);
+    Pgo_add(&profile, Pgo_call, &cold->fnCall->span, 2);
+
+    FixedBuf fb = {.data = arena, .capacity = sizeof arena};
+    Alloc fba = Alloc_fromFixedBuf(&fb);
+    ModuleOpt_Config cfg = {.inlineCost = 2, .inlineRounds = 1,
+                            .alloc = &fba};
+
+    // too big without a profile
+    ModuleOpt_Stats stats = ModuleOpt_run(&m, &cfg);
+    assert(stats.inlined == 0);
+
+    // the hot thresholds left 0 take the defaults
+    cfg.profile = &profile;
+    stats = ModuleOpt_run(&m, &cfg);
+    assert(stats.inlined == 1);
+    assert(stats.dropped == 0);
+
+    Expr_BinOp *ret = mainBody.return_stmt->binOp;
+    assert(ret->left->type == Expr_binOp);
+    assert(ret->right->type == Expr_fnCall);
+    Pgo_free(&profile);
+}
+
+static char treeArena[1 << 14];
+
+// the tree lives in `treeArena`
+static void parse(const char *src, Ast_Module *m) {
+    TokBuf toks;
+    TokBuf_init(&toks);
+    assert(TokBuf_lex(&toks, src, strlen(src), 1));
+    Parser p;
+    assert(Parser_initTokBuf(&p, "m.l1", src, strlen(src), &toks, false));
+    static FixedBuf fb;
+    static Alloc fba;
+    fb = (FixedBuf){.data = treeArena, .capacity = sizeof treeArena};
+    fba = Alloc_fromFixedBuf(&fb);
+    p.alloc = &fba;
+    assert(Parser_parseModule(&p, m));
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+}
+
+void test_parsed() {
+    // a label closing a block has no statement
+    Ast_Module m;
+    parse("fn _one() int { return 1; }\n"
+          "export fn _f(_n: int) int {\n"
+          "    if (_n > 0) { _n = _one(); _end: }\n"
+          "    return _n;\n"
+          "}\n",
+          &m);
+
+    ModuleOpt_Stats stats = ModuleOpt_run(&m, NULL);
+    assert(stats.inlined == 1);
+    assert(stats.dropped == 1);
+    assert(m.declc == 1 && !strcmp(m.declv[0].fn.name, "_f"));
+    Stmt_If *guard = m.declv[0].fn.stmtv[0].if_stmt;
+    assert(guard->stmtv[0].assign->rvalue->type == Expr_lit);
+}
+
+int main() {
+    printf("module inline and drop...");
+    test_inline_and_drop();
+    printf("OK!\n");
+    printf("module not inlined...");
+    test_not_inlined();
+    printf("OK!\n");
+    printf("module hot call...");
+    test_hot_call();
+    printf("OK!\n");
+    printf("module parsed...");
+    test_parsed();
+    printf("OK!\n");
+}
+
+#endif
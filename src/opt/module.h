@@ -0,0 +1,47 @@
+// whole-module optimization: inlining of small functions, then removal of
+// every declaration that cannot be reached from an exported one.
+
+#pragma once
+
+#include "../ast.h"
+#include "../common/mem/alloc.h"
+#include "../pgo.h"
+#include <stddef.h>
+
+typedef struct ModuleOpt_Config {
+    // expression functions (a body of just `return expr;`) of at most this
+    // many nodes are inlined at every call site. functions with a single call
+    // site are inlined whatever their size.
+    size_t inlineCost;
+
+    // rounds of inlining, each one expanding calls exposed by the last
+    unsigned inlineRounds;
+
+    // allocator for the inlined copies, `mAlloc` if NULL
+    Alloc *alloc;
+
+    // optional profile from an instrumented run. call sites made at least
+    // `hotCalls` times inline functions of up to `hotInlineCost` nodes. 0
+    // for either takes its MODULEOPT_DEFAULT_HOT_* value.
+    const Pgo_Profile *profile;
+    uint64_t hotCalls;
+    size_t hotInlineCost;
+} ModuleOpt_Config;
+
+#define MODULEOPT_DEFAULT_COST 16
+#define MODULEOPT_DEFAULT_ROUNDS 3
+#define MODULEOPT_DEFAULT_HOT_CALLS 1000
+#define MODULEOPT_DEFAULT_HOT_COST 64
+
+typedef struct ModuleOpt_Stats {
+    size_t inlined;
+    size_t dropped;
+} ModuleOpt_Stats;
+
+// inlines small non-exported functions into their callers and drops every
+// function and global unreachable from an exported declaration. a module
+// with no exports keeps nothing. `cfg` may be NULL for the defaults.
+ModuleOpt_Stats ModuleOpt_run(Ast_Module *m, const ModuleOpt_Config *cfg);
+
+// only the dead declaration removal. returns the number dropped.
+size_t ModuleOpt_dropUnreachable(Ast_Module *m);
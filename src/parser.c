@@ -7,16 +7,54 @@
 
 static bool advance(Parser *p);
 
-bool Parser_init(Parser *p, char *docName, Lexer *lex) {
+static void basicInit(Parser *p, char *docName, Lexer *lex, TokRing *ring) {
     *p = (Parser){
         .inputName = docName,
         .lex = lex,
-        .cur = (TokContext){0},
-        .next = (TokContext){0},
-        .err = (ParseError){0},
+        .ring = ring,
+        .alloc = &mAlloc,
     };
     ByteBuf_init(&p->cur.valueBuf, 20);
     ByteBuf_init(&p->next.valueBuf, 20);
+}
+
+bool Parser_init(Parser *p, char *docName, Lexer *lex) {
+    basicInit(p, docName, lex, NULL);
+    return advance(p) && advance(p);
+}
+
+bool Parser_initPipelined(Parser *p, char *docName, Lexer *lex, TokRing *ring,
+                          size_t ringCapacity) {
+    if (!TokRing_start(ring, lex, ringCapacity)) {
+        *p = (Parser){0};
+        return false;
+    }
+
+    // the lexer belongs to the producer thread from here on
+    basicInit(p, docName, NULL, ring);
+    return advance(p) && advance(p);
+}
+
+bool Parser_initTokBuf(Parser *p, char *docName, const char *src, size_t len,
+                       const TokBuf *toks, bool lazy) {
+    basicInit(p, docName, NULL, NULL);
+    p->toks = toks;
+    p->src = src;
+    p->lazy = lazy;
+
+    size_t capacity = 64;
+    p->lineStarts = malloc(capacity * sizeof(size_t));
+    assert(p->lineStarts != NULL);
+    p->lineStarts[p->linec++] = 0;
+    for (const char *nl = src; (nl = memchr(nl, '\n', len - (nl - src)));) {
+        nl++;
+        if (p->linec == capacity) {
+            capacity *= 2;
+            p->lineStarts = realloc(p->lineStarts, capacity * sizeof(size_t));
+            assert(p->lineStarts != NULL);
+        }
+        p->lineStarts[p->linec++] = (size_t)(nl - src);
+    }
 
     return advance(p) && advance(p);
 }
@@ -24,38 +62,90 @@ bool Parser_init(Parser *p, char *docName, Lexer *lex) {
 void Parser_cleanup(Parser *p) {
     ByteBuf_free(&p->cur.valueBuf);
     ByteBuf_free(&p->next.valueBuf);
+    free(p->lineStarts);
     *p = (Parser){0};
 }
 
+// tokens //////////////////////////////////////////////////////////////////////
+
+// the position of byte `offset`. tokens are mostly read in order, so the
+// current line is only searched for when the parser jumps back.
+static SrcPosn posnAt(Parser *p, size_t offset) {
+    if (offset < p->lineStarts[p->line]) {
+        size_t lo = 0, hi = p->line;
+        while (lo < hi) {
+            size_t mid = (lo + hi + 1) / 2;
+            if (p->lineStarts[mid] <= offset)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        p->line = lo;
+    }
+    while (p->line + 1 < p->linec && p->lineStarts[p->line + 1] <= offset)
+        p->line++;
+    return (SrcPosn){.row = p->line, .col = offset - p->lineStarts[p->line]};
+}
+
+static void nextFromBuf(Parser *p) {
+    const TokBuf *toks = p->toks;
+    size_t i = p->tokPos++;
+    p->next.tok = TokBuf_kind(toks, i);
+
+    size_t start = i < toks->len ? toks->starts[i] : 0;
+    size_t len = i < toks->len ? toks->lens[i] : 0;
+    if (i >= toks->len && toks->len > 0)
+        start = toks->starts[toks->len - 1] + toks->lens[toks->len - 1];
+    p->next.span.start = posnAt(p, start);
+    p->next.span.end = p->next.span.start;
+    p->next.span.end.col += len;
+
+    if (p->next.tok == Token_ident || p->next.tok == Token_decLit) {
+        p->next.valueBuf.len = 0;
+        ByteBuf_appendArr(&p->next.valueBuf, p->src + start, len);
+        ByteBuf_append(&p->next.valueBuf, 0);
+        p->next.value = p->next.valueBuf.data;
+    }
+}
+
 static bool advance(Parser *p) {
     // do nothing if we have already errored (for now)
-    if ERROR (p->cur.tok)
+    if (p->cur.tok != EOF && ERROR(p->cur.tok))
         return false;
 
-    Token tok = Lexer_next(p->lex);
-
+    p->lastEnd = p->cur.span.end;
     ByteBuf curBuf = p->cur.valueBuf;
     p->cur = p->next;
 
     p->next = (TokContext){
-        .tok = tok,
-        .span =
-            {
-                .docName = p->inputName,
-                .start = p->lex->startPosn,
-                .end = p->lex->curPosn,
-            },
+        .span = {.docName = p->inputName},
         .valueBuf = curBuf,
         .value = NULL,
     };
 
-    // copy over token value if it exists.
-    if (p->lex->tokenValue != NULL) {
-        ByteBuf_copy(&p->next.valueBuf, &p->lex->valueBuf);
-        p->next.value = p->next.valueBuf.data;
+    if (p->toks != NULL) {
+        nextFromBuf(p);
+    } else if (p->ring != NULL) {
+        p->next.tok = TokRing_pop(p->ring, &p->next.span.start,
+                                  &p->next.span.end, &p->next.valueBuf);
+        p->next.span.end.col += 1;
+        if (p->next.valueBuf.len > 0)
+            p->next.value = p->next.valueBuf.data;
+    } else {
+        p->next.tok = Lexer_next(p->lex);
+        p->next.span.start = p->lex->startPosn;
+        // the lexer's end is the last character, spans end one past it
+        p->next.span.end = p->lex->curPosn;
+        p->next.span.end.col += 1;
+
+        // copy over token value if it exists.
+        if (p->lex->tokenValue != NULL) {
+            ByteBuf_copy(&p->next.valueBuf, &p->lex->valueBuf);
+            p->next.value = p->next.valueBuf.data;
+        }
     }
 
-    if ERROR (p->cur.tok) {
+    if (p->cur.tok != EOF && ERROR(p->cur.tok)) {
         p->err = (ParseError){
             .span = p->cur.span,
 
@@ -67,10 +157,499 @@ static bool advance(Parser *p) {
     return true;
 }
 
+// makes token `i` of the buffer current
+static void seek(Parser *p, size_t i) {
+    p->tokPos = i;
+    p->cur.tok = p->next.tok = Token_ident;
+    advance(p);
+    advance(p);
+}
+
+static bool unexpected(Parser *p, Token want) {
+    if (p->cur.tok != EOF && ERROR(p->cur.tok))
+        return false; // already reported by `advance()`
+    p->err = (ParseError){
+        .span = p->cur.span,
+        .type = ParseError_unexpected,
+        .unexpected = {.got = p->cur.tok, .want = want},
+    };
+    return false;
+}
+
+static bool expect(Parser *p, Token want) {
+    if (p->cur.tok != want)
+        return unexpected(p, want);
+    advance(p);
+    return true;
+}
+
+// nodes ///////////////////////////////////////////////////////////////////////
+
+static void *newNode(Parser *p, size_t size) {
+    void *node = Mem_alloc(p->alloc, size);
+    assert(node != NULL);
+    return node;
+}
+
+static bool expectIdent(Parser *p, char **name) {
+    if (p->cur.tok != Token_ident)
+        return unexpected(p, Token_ident);
+    size_t len = strlen(p->cur.value);
+    *name = newNode(p, len + 1);
+    memcpy(*name, p->cur.value, len + 1);
+    advance(p);
+    return true;
+}
+
+// a list that grows on the heap while it is parsed, then moves to the tree
+typedef struct Scratch {
+    char *data;
+    size_t len;
+    size_t capacity;
+    size_t size;
+} Scratch;
+
+static void push(Scratch *s, const void *item) {
+    if (s->len == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 8;
+        s->data = realloc(s->data, s->capacity * s->size);
+        assert(s->data != NULL);
+    }
+    memcpy(s->data + s->len++ * s->size, item, s->size);
+}
+
+static void *finish(Parser *p, Scratch *s, size_t *count) {
+    *count = s->len;
+    void *items = NULL;
+    if (s->len > 0) {
+        items = newNode(p, s->len * s->size);
+        memcpy(items, s->data, s->len * s->size);
+    }
+    free(s->data);
+    return items;
+}
+
+static SrcSpan spanFrom(Parser *p, SrcPosn start) {
+    return (SrcSpan){.docName = p->inputName, .start = start,
+                     .end = p->lastEnd};
+}
+
+// types ///////////////////////////////////////////////////////////////////////
+
+static bool parseType(Parser *p, Ast_TypeExpr **out) {
+    Ast_TypeExpr *t = newNode(p, sizeof(Ast_TypeExpr));
+    *t = (Ast_TypeExpr){0};
+    *out = t;
+
+    switch (p->cur.tok) {
+    case Token_void:
+        t->type = TypeExpr_void;
+        break;
+    case Token_int:
+        t->type = TypeExpr_int;
+        break;
+    case Token_bool:
+        t->type = TypeExpr_bool;
+        break;
+    case Token_ptr:
+    case Token_const:
+        t->type = p->cur.tok == Token_ptr ? TypeExpr_ptr : TypeExpr_const;
+        advance(p);
+        return parseType(p, &t->inner);
+    case Token_lParen:
+        advance(p);
+        return parseType(p, out) && expect(p, Token_rParen);
+    default:
+        return unexpected(p, Token_unexpected);
+    }
+    advance(p);
+    return true;
+}
+
+// expressions /////////////////////////////////////////////////////////////////
+
+static bool parseExpr(Parser *p, Ast_Expr *out);
+
+static Ast_Expr *newExpr(Parser *p) {
+    return newNode(p, sizeof(Ast_Expr));
+}
+
+// binding power of a binary operator, 0 if `tok` is not one
+static int binaryPrec(Token tok, int *op) {
+    switch (tok) {
+    case Token_boolOr:
+        *op = BinOp_boolOr;
+        return 1;
+    case Token_boolAnd:
+        *op = BinOp_boolAnd;
+        return 2;
+    case Token_binOr:
+        *op = BinOp_binOr;
+        return 3;
+    case Token_xOr:
+        *op = BinOp_xOr;
+        return 4;
+    case Token_binAnd:
+        *op = BinOp_binAnd;
+        return 5;
+    case Token_eq:
+    case Token_nEq:
+        *op = tok == Token_eq ? BinOp_eq : BinOp_nEq;
+        return 6;
+    case Token_lt:
+    case Token_gt:
+    case Token_ltEq:
+    case Token_gtEq:
+        *op = tok == Token_lt   ? BinOp_lt
+              : tok == Token_gt ? BinOp_gt
+              : tok == Token_ltEq ? BinOp_ltEq
+                                  : BinOp_gtEq;
+        return 7;
+    case Token_lShift:
+    case Token_rShift:
+        *op = tok == Token_lShift ? BinOp_lShift : BinOp_rShift;
+        return 8;
+    case Token_add:
+    case Token_sub:
+        *op = tok == Token_add ? BinOp_plus : BinOp_minus;
+        return 9;
+    case Token_mul:
+    case Token_div:
+        *op = tok == Token_mul ? BinOp_mul : BinOp_div;
+        return 10;
+    default:
+        return 0;
+    }
+}
+
+static bool parseLit(Parser *p, Ast_Expr *out, bool negative) {
+    Expr_Lit *lit = newNode(p, sizeof(Expr_Lit));
+    *out = (Ast_Expr){.type = Expr_lit, .lit = lit};
+    if (p->cur.tok == Token_true || p->cur.tok == Token_false) {
+        *lit = (Expr_Lit){.type = Lit_bool,
+                          .boolean = p->cur.tok == Token_true};
+        advance(p);
+        return true;
+    }
+
+    // negative literals are kept two's complement
+    size_t n = (size_t)strtoull(p->cur.value, NULL, 10);
+    *lit = (Expr_Lit){.type = Lit_int, .integer = negative ? 0 - n : n};
+    advance(p);
+    return true;
+}
+
+static bool parsePostfix(Parser *p, Ast_Expr *out);
+
+static bool parsePrimary(Parser *p, Ast_Expr *out) {
+    switch (p->cur.tok) {
+    case Token_lParen:
+        advance(p);
+        return parseExpr(p, out) && expect(p, Token_rParen);
+    case Token_decLit:
+    case Token_true:
+    case Token_false:
+        return parseLit(p, out, false);
+    case Token_sub:
+        advance(p);
+        if (p->cur.tok != Token_decLit)
+            return unexpected(p, Token_decLit);
+        return parseLit(p, out, true);
+    case Token_ident:
+        out->type = Expr_ident;
+        return expectIdent(p, &out->ident);
+    case Token_ptr:
+        advance(p);
+        out->type = Expr_ptr;
+        return expectIdent(p, &out->ptr);
+    case Token_val:
+        advance(p);
+        out->type = Expr_val;
+        out->val = newExpr(p);
+        return parsePostfix(p, out->val);
+    default:
+        return unexpected(p, Token_unexpected);
+    }
+}
+
+// calls and `: type` bind tighter than any operator
+static bool parsePostfix(Parser *p, Ast_Expr *out) {
+    SrcPosn start = p->cur.span.start;
+    if (!parsePrimary(p, out))
+        return false;
+
+    for (;;) {
+        if (p->cur.tok == Token_lParen) {
+            advance(p);
+            Expr_FnCall *call = newNode(p, sizeof(Expr_FnCall));
+            *call = (Expr_FnCall){.head = newExpr(p)};
+            *call->head = *out;
+
+            Scratch args = {.size = sizeof(Ast_Expr)};
+            bool ok = true;
+            while (ok && p->cur.tok != Token_rParen) {
+                Ast_Expr arg;
+                ok = parseExpr(p, &arg);
+                if (ok)
+                    push(&args, &arg);
+                if (ok && p->cur.tok != Token_rParen)
+                    ok = expect(p, Token_comma);
+            }
+            call->argv = finish(p, &args, &call->argc);
+            if (!ok || !expect(p, Token_rParen))
+                return false;
+            call->span = spanFrom(p, start);
+            *out = (Ast_Expr){.type = Expr_fnCall, .fnCall = call};
+        } else if (p->cur.tok == Token_colon) {
+            advance(p);
+            Expr_AsType *as = newNode(p, sizeof(Expr_AsType));
+            as->expr = newExpr(p);
+            *as->expr = *out;
+            if (!parseType(p, &as->type))
+                return false;
+            *out = (Ast_Expr){.type = Expr_asType, .asType = as};
+        } else {
+            return true;
+        }
+    }
+}
+
+static bool parseBinary(Parser *p, Ast_Expr *out, int minPrec) {
+    if (!parsePostfix(p, out))
+        return false;
+
+    int op, prec;
+    while ((prec = binaryPrec(p->cur.tok, &op)) >= minPrec && prec > 0) {
+        advance(p);
+        Expr_BinOp *bin = newNode(p, sizeof(Expr_BinOp));
+        *bin = (Expr_BinOp){.type = op,
+                            .left = newExpr(p),
+                            .right = newExpr(p)};
+        *bin->left = *out;
+        if (!parseBinary(p, bin->right, prec + 1))
+            return false;
+        *out = (Ast_Expr){.type = Expr_binOp, .binOp = bin};
+    }
+    return true;
+}
+
+static bool parseExpr(Parser *p, Ast_Expr *out) {
+    return parseBinary(p, out, 1);
+}
+
+// statements //////////////////////////////////////////////////////////////////
+
+static bool parseStmt(Parser *p, Ast_Stmt *out);
+
+// 'const' | 'var' IDENT ':' type '=' expr ';'
+static bool parseVar(Parser *p, Decl_Var *out) {
+    *out = (Decl_Var){.is_const = p->cur.tok == Token_const,
+                      .init = newExpr(p)};
+    advance(p);
+    return expectIdent(p, &out->name) && expect(p, Token_colon) &&
+           parseType(p, &out->type) && expect(p, Token_assign) &&
+           parseExpr(p, out->init) && expect(p, Token_semi);
+}
+
+// statements up to the closing brace, which is consumed
+static bool parseBlock(Parser *p, size_t *stmtc, Ast_Stmt **stmtv) {
+    Scratch stmts = {.size = sizeof(Ast_Stmt)};
+    bool ok = true;
+    while (ok && p->cur.tok != Token_rBrace) {
+        Ast_Stmt stmt;
+        if (p->cur.tok == EOF)
+            ok = unexpected(p, Token_rBrace);
+        else
+            ok = parseStmt(p, &stmt);
+        if (ok)
+            push(&stmts, &stmt);
+    }
+    *stmtv = finish(p, &stmts, stmtc);
+    return ok && expect(p, Token_rBrace);
+}
+
+static bool parseIf(Parser *p, Stmt_If *out) {
+    *out = (Stmt_If){.cond = newExpr(p)};
+    if (!expect(p, Token_if) || !expect(p, Token_lParen) ||
+        !parseExpr(p, out->cond) || !expect(p, Token_rParen))
+        return false;
+
+    if (p->cur.tok == Token_lBrace) {
+        advance(p);
+        return parseBlock(p, &out->stmtc, &out->stmtv);
+    }
+    out->stmtc = 1;
+    out->stmtv = newNode(p, sizeof(Ast_Stmt));
+    return parseStmt(p, out->stmtv);
+}
+
+static bool parseStmt(Parser *p, Ast_Stmt *out) {
+    SrcPosn start = p->cur.span.start;
+    *out = (Ast_Stmt){0};
+
+    bool ok;
+    switch (p->cur.tok) {
+    case Token_const:
+    case Token_var:
+        out->type = Stmt_decl;
+        out->decl = newNode(p, sizeof(Decl_Var));
+        ok = parseVar(p, out->decl);
+        break;
+    case Token_return:
+        advance(p);
+        out->type = Stmt_return;
+        if (p->cur.tok != Token_semi) {
+            out->return_stmt = newExpr(p);
+            ok = parseExpr(p, out->return_stmt) && expect(p, Token_semi);
+        } else {
+            ok = expect(p, Token_semi);
+        }
+        break;
+    case Token_goto:
+        advance(p);
+        out->type = Stmt_goto;
+        ok = expectIdent(p, &out->goto_stmt) && expect(p, Token_semi);
+        break;
+    case Token_if:
+        out->type = Stmt_if;
+        out->if_stmt = newNode(p, sizeof(Stmt_If));
+        ok = parseIf(p, out->if_stmt);
+        break;
+    default:
+        // IDENT ':' stmt, where a label may also close a block
+        if (p->cur.tok == Token_ident && p->next.tok == Token_colon) {
+            out->type = Stmt_label;
+            out->label = newNode(p, sizeof(Stmt_Label));
+            *out->label = (Stmt_Label){0};
+            ok = expectIdent(p, &out->label->name) && expect(p, Token_colon);
+            if (ok && p->cur.tok != Token_rBrace) {
+                out->label->stmt = newNode(p, sizeof(Ast_Stmt));
+                ok = parseStmt(p, out->label->stmt);
+            }
+            break;
+        }
+
+        Ast_Expr *expr = newExpr(p);
+        ok = parseExpr(p, expr);
+        if (ok && p->cur.tok == Token_assign) {
+            advance(p);
+            out->type = Stmt_assign;
+            out->assign = newNode(p, sizeof(Stmt_Assign));
+            *out->assign = (Stmt_Assign){.lvalue = expr, .rvalue = newExpr(p)};
+            ok = parseExpr(p, out->assign->rvalue);
+        } else {
+            out->type = Stmt_expr;
+            out->expr = expr;
+        }
+        ok = ok && expect(p, Token_semi);
+        break;
+    }
+
+    out->span = spanFrom(p, start);
+    return ok;
+}
+
+// declarations ////////////////////////////////////////////////////////////////
+
+// skips a body by matching braces over the token kinds alone. `p->cur` is
+// its opening brace.
+static bool skimBody(Parser *p, Decl_Fn *fn) {
+    const TokBuf *toks = p->toks;
+    size_t open = p->tokPos - 2;
+    size_t depth = 0;
+    for (size_t i = open; i < toks->len; i++) {
+        if (toks->kinds[i] == Token_lBrace) {
+            depth++;
+        } else if (toks->kinds[i] == Token_rBrace && --depth == 0) {
+            fn->body_pending = true;
+            fn->body_start = open + 1;
+            fn->body_end = i;
+            seek(p, i);
+            advance(p);
+            return true;
+        }
+    }
+    seek(p, toks->len);
+    return unexpected(p, Token_rBrace);
+}
+
+// 'fn' IDENT '(' list(IDENT ':' type, ',') ')' type '{' stmt* '}'
+static bool parseFn(Parser *p, Decl_Fn *fn, SrcPosn start) {
+    *fn = (Decl_Fn){0};
+    if (!expect(p, Token_fn) || !expectIdent(p, &fn->name) ||
+        !expect(p, Token_lParen))
+        return false;
+
+    Scratch args = {.size = sizeof(Decl_Var)};
+    bool ok = true;
+    while (ok && p->cur.tok != Token_rParen) {
+        Decl_Var arg = {0};
+        ok = expectIdent(p, &arg.name) && expect(p, Token_colon) &&
+             parseType(p, &arg.type);
+        if (ok)
+            push(&args, &arg);
+        if (ok && p->cur.tok != Token_rParen)
+            ok = expect(p, Token_comma);
+    }
+    fn->argv = finish(p, &args, &fn->argc);
+    if (!ok || !expect(p, Token_rParen) || !parseType(p, &fn->ret_type))
+        return false;
+    if (fn->ret_type->type == TypeExpr_void)
+        fn->ret_type = NULL;
+
+    if (p->cur.tok != Token_lBrace)
+        return unexpected(p, Token_lBrace);
+    if (p->lazy)
+        ok = skimBody(p, fn);
+    else
+        ok = advance(p) && parseBlock(p, &fn->stmtc, &fn->stmtv);
+    fn->span = spanFrom(p, start);
+    return ok;
+}
+
+bool Parser_parseModule(Parser *p, Ast_Module *m) {
+    Scratch decls = {.size = sizeof(Ast_Decl)};
+    bool ok = true;
+    while (ok && p->cur.tok != EOF) {
+        SrcPosn start = p->cur.span.start;
+        Ast_Decl d = {0};
+        if (p->cur.tok == Token_export) {
+            d.is_exported = true;
+            advance(p);
+        }
+
+        if (p->cur.tok == Token_fn) {
+            d.type = Decl_fn;
+            ok = parseFn(p, &d.fn, start);
+        } else if (p->cur.tok == Token_const || p->cur.tok == Token_var) {
+            d.type = Decl_var;
+            ok = parseVar(p, &d.var);
+        } else {
+            ok = unexpected(p, Token_fn);
+        }
+        if (ok)
+            push(&decls, &d);
+    }
+    m->declv = finish(p, &decls, &m->declc);
+    return ok;
+}
+
+bool Parser_parseBody(Parser *p, Decl_Fn *fn) {
+    if (!fn->body_pending)
+        return true;
+    assert(p->toks != NULL);
+
+    seek(p, fn->body_start);
+    if (!parseBlock(p, &fn->stmtc, &fn->stmtv))
+        return false;
+    fn->body_pending = false;
+    return true;
+}
+
 #ifdef TESTING
 #include <stdio.h>
 
-int main() {
+void test_advance() {
     TestLexer_ReadCtx rctx;
     Lexer lex;
     Lexer_init(&lex);
@@ -79,13 +658,13 @@ int main() {
     Parser parser;
     Parser_init(&parser, "(test)", &lex);
 
-    printf("current val: %s\n", parser.cur.value);
-    printf("next val: %s\n", parser.next.value);
+    assert(!strcmp(parser.cur.value, "three"));
+    assert(!strcmp(parser.next.value, "words"));
 
     advance(&parser);
 
-    printf("current val: %s\n", parser.cur.value);
-    printf("next val: %s\n", parser.next.value);
+    assert(!strcmp(parser.cur.value, "words"));
+    assert(!strcmp(parser.next.value, "here"));
 
     advance(&parser);
 
@@ -94,6 +673,256 @@ int main() {
 
     Parser_cleanup(&parser);
     Lexer_cleanup(&lex);
+
+    // the same through the pipelined lexer
+    Lexer_init(&lex);
+    TestLexer_init(rctx, lex, "three words here");
+
+    TokRing ring;
+    assert(Parser_initPipelined(&parser, "(test)", &lex, &ring, 4));
+
+    assert(parser.cur.tok == Token_ident);
+    assert(!strcmp(parser.cur.value, "three"));
+    assert(!strcmp(parser.next.value, "words"));
+
+    advance(&parser);
+    advance(&parser);
+
+    assert(!strcmp(parser.cur.value, "here"));
+    assert(parser.next.tok == EOF);
+    assert(parser.next.value == NULL);
+
+    Parser_cleanup(&parser);
+    TokRing_cleanup(&ring);
+    Lexer_cleanup(&lex);
+}
+
+static const char program[] =
+    "const _k: int = -4;\n"
+    "export fn _sq(_x: int) int { return _x * _x; }\n"
+    "fn _f(_a: int, _p: ptr int) void {\n"
+    "    var _i: int = 0;\n"
+    "    _top: if (_i < _k + 1 * 2) {\n"
+    "        val _p = val _p + _sq(_i: int);\n"
+    "        _i = _i + 1;\n"
+    "        goto _top;\n"
+    "    }\n"
+    "    return;\n"
+    "}\n";
+
+static char arena[16384];
+
+static void checkBody(const Decl_Fn *f) {
+    assert(!f->body_pending);
+    assert(f->stmtc == 3);
+    assert(f->stmtv[0].type == Stmt_decl);
+    assert(!strcmp(f->stmtv[0].decl->name, "_i"));
+    assert(f->stmtv[2].type == Stmt_return && f->stmtv[2].return_stmt == NULL);
+
+    const Ast_Stmt *top = &f->stmtv[1];
+    assert(top->type == Stmt_label);
+    assert(top->span.start.row == 4 && top->span.start.col == 4);
+    assert(top->span.end.row == 8 && top->span.end.col == 5);
+    const Stmt_If *loop = top->label->stmt->if_stmt;
+
+    // _i < (_k + (1 * 2))
+    assert(loop->cond->binOp->type == BinOp_lt);
+    const Expr_BinOp *sum = loop->cond->binOp->right->binOp;
+    assert(sum->type == BinOp_plus);
+    assert(sum->right->binOp->type == BinOp_mul);
+
+    assert(loop->stmtc == 3);
+    const Stmt_Assign *store = loop->stmtv[0].assign;
+    assert(store->lvalue->type == Expr_val);
+    const Expr_FnCall *call = store->rvalue->binOp->right->fnCall;
+    assert(!strcmp(call->head->ident, "_sq"));
+    assert(call->argc == 1 && call->argv[0].type == Expr_asType);
+    assert(call->span.start.row == 5 && call->span.start.col == 26);
+    assert(loop->stmtv[2].type == Stmt_goto);
+    assert(!strcmp(loop->stmtv[2].goto_stmt, "_top"));
+}
+
+static void parse(bool lazy, Ast_Module *m, Parser *p, TokBuf *toks) {
+    TokBuf_init(toks);
+    assert(TokBuf_lex(toks, program, sizeof program - 1, 1));
+    assert(Parser_initTokBuf(p, "p.l1", program, sizeof program - 1, toks,
+                             lazy));
+    static FixedBuf fb;
+    static Alloc fba;
+    fb = (FixedBuf){.data = arena, .capacity = sizeof arena};
+    fba = Alloc_fromFixedBuf(&fb);
+    p->alloc = &fba;
+    assert(Parser_parseModule(p, m));
+}
+
+void test_module() {
+    Ast_Module m;
+    Parser p;
+    TokBuf toks;
+    parse(false, &m, &p, &toks);
+
+    assert(m.declc == 3);
+    assert(m.declv[0].type == Decl_var && m.declv[0].var.is_const);
+    assert(m.declv[0].var.init->lit->integer == (size_t)-4);
+    assert(m.declv[1].is_exported);
+    assert(m.declv[1].fn.ret_type->type == TypeExpr_int);
+    assert(m.declv[1].fn.stmtc == 1);
+
+    const Decl_Fn *f = &m.declv[2].fn;
+    assert(!m.declv[2].is_exported);
+    assert(f->ret_type == NULL);
+    assert(f->argc == 2 && f->argv[1].type->type == TypeExpr_ptr);
+    assert(f->span.start.row == 2 && f->span.end.row == 10);
+    checkBody(f);
+
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+}
+
+void test_lazy() {
+    Ast_Module m;
+    Parser p;
+    TokBuf toks;
+    parse(true, &m, &p, &toks);
+
+    assert(m.declc == 3);
+    Decl_Fn *f = &m.declv[2].fn;
+    assert(f->body_pending && f->stmtc == 0);
+    assert(f->argc == 2);
+    assert(f->span.start.row == 2 && f->span.end.row == 10);
+    assert(toks.kinds[f->body_start - 1] == Token_lBrace);
+    assert(toks.kinds[f->body_end] == Token_rBrace);
+
+    // bodies parse in any order, and only once
+    assert(Parser_parseBody(&p, f));
+    checkBody(f);
+    assert(Parser_parseBody(&p, f));
+    assert(Parser_parseBody(&p, &m.declv[1].fn));
+    assert(m.declv[1].fn.stmtc == 1);
+
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+}
+
+static bool samePosn(SrcPosn a, SrcPosn b) {
+    return a.row == b.row && a.col == b.col;
+}
+
+static bool sameSpan(const SrcSpan *a, const SrcSpan *b) {
+    return samePosn(a->start, b->start) && samePosn(a->end, b->end);
+}
+
+static void checkSameSpans(const Ast_Module *a, const Ast_Module *b) {
+    assert(a->declc == b->declc);
+    for (size_t i = 1; i < a->declc; i++) {
+        const Decl_Fn *fa = &a->declv[i].fn, *fb = &b->declv[i].fn;
+        assert(sameSpan(&fa->span, &fb->span));
+        assert(fa->stmtc == fb->stmtc);
+        for (size_t j = 0; j < fa->stmtc; j++) {
+            assert(sameSpan(&fa->stmtv[j].span, &fb->stmtv[j].span));
+        }
+    }
+    const Stmt_If *la = a->declv[2].fn.stmtv[1].label->stmt->if_stmt;
+    const Stmt_If *lb = b->declv[2].fn.stmtv[1].label->stmt->if_stmt;
+    for (size_t j = 0; j < la->stmtc; j++) {
+        assert(sameSpan(&la->stmtv[j].span, &lb->stmtv[j].span));
+    }
+    assert(sameSpan(&la->stmtv[0].assign->rvalue->binOp->right->fnCall->span,
+                    &lb->stmtv[0].assign->rvalue->binOp->right->fnCall->span));
+}
+
+void test_spans() {
+    static char lexArena[16384], ringArena[16384];
+    Ast_Module bufMod, lexMod, ringMod;
+    Parser p;
+    TokBuf toks;
+    parse(false, &bufMod, &p, &toks);
+    Parser_cleanup(&p);
+    TokBuf_free(&toks);
+
+    TestLexer_ReadCtx rctx;
+    Lexer lex;
+    Lexer_init(&lex);
+    TestLexer_init(rctx, lex, program);
+    assert(Parser_init(&p, "p.l1", &lex));
+    FixedBuf fb = {.data = lexArena, .capacity = sizeof lexArena};
+    Alloc fba = Alloc_fromFixedBuf(&fb);
+    p.alloc = &fba;
+    assert(Parser_parseModule(&p, &lexMod));
+    Parser_cleanup(&p);
+    Lexer_cleanup(&lex);
+    checkBody(&lexMod.declv[2].fn);
+    checkSameSpans(&bufMod, &lexMod);
+
+    Lexer_init(&lex);
+    TestLexer_init(rctx, lex, program);
+    TokRing ring;
+    assert(Parser_initPipelined(&p, "p.l1", &lex, &ring, 4));
+    FixedBuf ringFb = {.data = ringArena, .capacity = sizeof ringArena};
+    Alloc ringFba = Alloc_fromFixedBuf(&ringFb);
+    p.alloc = &ringFba;
+    assert(Parser_parseModule(&p, &ringMod));
+    Parser_cleanup(&p);
+    TokRing_cleanup(&ring);
+    Lexer_cleanup(&lex);
+    checkSameSpans(&bufMod, &ringMod);
+}
+
+void test_errors() {
+    static const char *bad[] = {
+        "fn _f( int) void {}",
+        "fn _f() void { return 1 }",
+        "fn _f() void { if (1) {",
+        "var _x: int = ;",
+    };
+    static const Token want[] = {Token_ident, Token_semi, Token_rBrace,
+                                 Token_unexpected};
+
+    for (int lazy = 0; lazy < 2; lazy++) {
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            TokBuf toks;
+            TokBuf_init(&toks);
+            assert(TokBuf_lex(&toks, bad[i], strlen(bad[i]), 1));
+            Parser p;
+            Parser_initTokBuf(&p, "e.l1", bad[i], strlen(bad[i]), &toks,
+                              lazy);
+            FixedBuf fb = {.data = arena, .capacity = sizeof arena};
+            Alloc fba = Alloc_fromFixedBuf(&fb);
+            p.alloc = &fba;
+
+            Ast_Module m;
+            bool ok = Parser_parseModule(&p, &m);
+            // a lazy parse only sees the broken body when it is parsed
+            if (ok) {
+                assert(lazy && i == 1);
+                ok = Parser_parseBody(&p, &m.declv[0].fn);
+            }
+            assert(!ok);
+            assert(p.err.type == ParseError_unexpected);
+            assert(p.err.unexpected.want == want[i]);
+
+            Parser_cleanup(&p);
+            TokBuf_free(&toks);
+        }
+    }
+}
+
+int main() {
+    printf("parser advance...");
+    test_advance();
+    printf("OK!\n");
+    printf("parser module...");
+    test_module();
+    printf("OK!\n");
+    printf("parser lazy...");
+    test_lazy();
+    printf("OK!\n");
+    printf("parser spans...");
+    test_spans();
+    printf("OK!\n");
+    printf("parser errors...");
+    test_errors();
+    printf("OK!\n");
 }
 
 #endif
@@ -2,8 +2,11 @@
 
 #include "ast.h"
 #include "common/bytebuf.h"
+#include "common/mem/alloc.h"
 #include "gendef.h"
 #include "lexer.h"
+#include "tokbuf.h"
+#include "tokring.h"
 
 typedef struct Parser Parser;
 typedef struct ParseError ParseError;
@@ -11,9 +14,15 @@ typedef struct TokContext TokContext;
 
 struct ParseError {
     SrcSpan span;
-    enum { ParseError_lexError } type;
+    enum { ParseError_lexError, ParseError_unexpected } type;
     union {
         Token lexError;
+        // the token found, and the one wanted, `Token_unexpected` when any
+        // of several would do
+        struct {
+            Token got;
+            Token want;
+        } unexpected;
     };
 };
 
@@ -28,8 +37,58 @@ struct Parser {
     char *inputName;
     Lexer *lex;
 
+    // when set, tokens are pulled from a lexer running on another thread
+    // instead of from `lex`. see `Parser_initPipelined()`.
+    TokRing *ring;
+
+    // when set, tokens are read out of an already lexed buffer over `src`,
+    // which lets function bodies be skipped and parsed later. see
+    // `Parser_initTokBuf()`.
+    const TokBuf *toks;
+    const char *src;
+    // index of `next` in `toks`
+    size_t tokPos;
+    // byte offset of the start of every line, to turn offsets into positions
+    size_t *lineStarts;
+    size_t linec;
+    size_t line;
+    bool lazy;
+
+    // allocator for the tree, `mAlloc` unless changed after init. nodes are
+    // not freed on errors, so an arena suits best.
+    Alloc *alloc;
+
     TokContext cur;
     TokContext next;
+    // end of the last token consumed, for spans
+    SrcPosn lastEnd;
 
     ParseError err;
 };
+
+bool Parser_init(Parser *p, char *docName, Lexer *lex);
+
+// like `Parser_init()`, but lexes on a separate thread, handing tokens over
+// through `ring`. the ring is started here and must outlive the parser; the
+// caller releases it with `TokRing_cleanup()` after `Parser_cleanup()`. if
+// the ring cannot be started `*p` is left zeroed, so both are still safe.
+bool Parser_initPipelined(Parser *p, char *docName, Lexer *lex, TokRing *ring,
+                          size_t ringCapacity);
+
+// like `Parser_init()`, but reads tokens lexed up front by `TokBuf_lex()`
+// over `src[0..len)`. both must outlive the parser. with `lazy` set,
+// `Parser_parseModule()` skips function bodies by matching braces and only
+// records where they are, for `Parser_parseBody()`. every body has to be
+// parsed before the module goes to the optimizers or the C backend.
+bool Parser_initTokBuf(Parser *p, char *docName, const char *src, size_t len,
+                       const TokBuf *toks, bool lazy);
+
+void Parser_cleanup(Parser *p);
+
+// parses a whole module into `m`. returns false and sets `p->err` on a
+// syntax error.
+bool Parser_parseModule(Parser *p, Ast_Module *m);
+
+// parses the body of `fn` if a lazy parse skipped it, with the parser that
+// parsed the module. returns true straight away if the body is there.
+bool Parser_parseBody(Parser *p, Decl_Fn *fn);
@@ -0,0 +1,317 @@
+#include "pgo.h"
+#include "common/macros.h"
+#include <string.h>
+
+#define INITIAL_CAPACITY 64
+
+// longest document name accepted when reading
+#define MAX_DOC_LEN 4096
+
+void Pgo_init(Pgo_Profile *p) {
+    *p = (Pgo_Profile){
+        .sites = calloc(INITIAL_CAPACITY, sizeof(Pgo_Site)),
+        .used = calloc(INITIAL_CAPACITY, sizeof(bool)),
+        .capacity = INITIAL_CAPACITY,
+    };
+    assert(p->sites != NULL && p->used != NULL);
+}
+
+void Pgo_free(Pgo_Profile *p) {
+    for (size_t i = 0; i < p->docc; i++)
+        free(p->docs[i]);
+    free(p->docs);
+    free(p->sites);
+    free(p->used);
+    *p = (Pgo_Profile){0};
+}
+
+static const char *docName(const SrcSpan *span) {
+    return span->docName != NULL ? span->docName : "";
+}
+
+// FNV-1a over the name, then the position
+static size_t hashKey(Pgo_Kind kind, const char *doc, size_t row, size_t col) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (; *doc; doc++) {
+        hash ^= (unsigned char)*doc;
+        hash *= 0x100000001b3u;
+    }
+    hash ^= row * 0x9e3779b97f4a7c15u;
+    hash *= 0x100000001b3u;
+    hash ^= col * 0xc2b2ae3d27d4eb4fu;
+    hash *= 0x100000001b3u;
+    hash ^= (uint64_t)kind;
+    return (size_t)(hash ^ (hash >> 29));
+}
+
+// the slot holding the site, or the empty slot where it belongs
+static size_t findSlot(const Pgo_Profile *p, Pgo_Kind kind, const char *doc,
+                       size_t row, size_t col) {
+    size_t mask = p->capacity - 1;
+    size_t i = hashKey(kind, doc, row, col) & mask;
+    for (; p->used[i]; i = (i + 1) & mask) {
+        const Pgo_Site *s = &p->sites[i];
+        if (s->kind == kind && s->row == row && s->col == col &&
+            !strcmp(p->docs[s->doc], doc))
+            return i;
+    }
+    return i;
+}
+
+static void grow(Pgo_Profile *p) {
+    Pgo_Profile old = *p;
+    p->capacity *= 2;
+    p->sites = calloc(p->capacity, sizeof(Pgo_Site));
+    p->used = calloc(p->capacity, sizeof(bool));
+    assert(p->sites != NULL && p->used != NULL);
+
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (!old.used[i])
+            continue;
+        const Pgo_Site *s = &old.sites[i];
+        size_t slot = findSlot(p, s->kind, p->docs[s->doc], s->row, s->col);
+        p->sites[slot] = *s;
+        p->used[slot] = true;
+    }
+    free(old.sites);
+    free(old.used);
+}
+
+// documents are few, so they are searched linearly
+static uint32_t docIndex(Pgo_Profile *p, const char *doc) {
+    for (size_t i = 0; i < p->docc; i++) {
+        if (!strcmp(p->docs[i], doc))
+            return (uint32_t)i;
+    }
+
+    size_t len = strlen(doc);
+    p->docs = realloc(p->docs, (p->docc + 1) * sizeof(char *));
+    assert(p->docs != NULL);
+    p->docs[p->docc] = malloc(len + 1);
+    assert(p->docs[p->docc] != NULL);
+    memcpy(p->docs[p->docc], doc, len + 1);
+    return (uint32_t)p->docc++;
+}
+
+void Pgo_add(Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span,
+             uint64_t count) {
+    if ((p->len + 1) * 2 > p->capacity)
+        grow(p);
+
+    const char *doc = docName(span);
+    size_t row = span->start.row, col = span->start.col;
+    size_t slot = findSlot(p, kind, doc, row, col);
+    if (!p->used[slot]) {
+        p->sites[slot] = (Pgo_Site){
+            .kind = kind,
+            .doc = docIndex(p, doc),
+            .row = row,
+            .col = col,
+        };
+        p->used[slot] = true;
+        p->len++;
+    }
+    p->sites[slot].count += count;
+}
+
+bool Pgo_lookup(const Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span,
+                uint64_t *count) {
+    size_t slot = findSlot(p, kind, docName(span), span->start.row,
+                           span->start.col);
+    if (!p->used[slot])
+        return false;
+    *count = p->sites[slot].count;
+    return true;
+}
+
+uint64_t Pgo_count(const Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span) {
+    uint64_t count = 0;
+    Pgo_lookup(p, kind, span, &count);
+    return count;
+}
+
+// File format /////////////////////////////////////////////////////////////////
+
+static void putVarint(FILE *out, uint64_t v) {
+    while (v >= 0x80) {
+        fputc((int)(v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    fputc((int)v, out);
+}
+
+static bool getVarint(FILE *in, uint64_t *v) {
+    *v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(in);
+        if (c == EOF)
+            return false;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool Pgo_write(const Pgo_Profile *p, FILE *out) {
+    fputs(PGO_MAGIC, out);
+    putVarint(out, p->docc);
+    for (size_t i = 0; i < p->docc; i++) {
+        size_t len = strlen(p->docs[i]);
+        putVarint(out, len);
+        fwrite(p->docs[i], 1, len, out);
+    }
+
+    putVarint(out, p->len);
+    for (size_t i = 0; i < p->capacity; i++) {
+        if (!p->used[i])
+            continue;
+        const Pgo_Site *s = &p->sites[i];
+        putVarint(out, s->kind);
+        putVarint(out, s->doc);
+        putVarint(out, s->row);
+        putVarint(out, s->col);
+        putVarint(out, s->count);
+    }
+    return !ferror(out);
+}
+
+static bool readChunk(Pgo_Profile *p, FILE *in) {
+    uint64_t docc;
+    if (!getVarint(in, &docc) || docc > UINT32_MAX)
+        return false;
+
+    // the chunk's document indices, mapped to names
+    char **docs = calloc(docc > 0 ? docc : 1, sizeof(char *));
+    assert(docs != NULL);
+    bool ok = true;
+    for (uint64_t i = 0; i < docc && ok; i++) {
+        uint64_t len;
+        ok = getVarint(in, &len) && len <= MAX_DOC_LEN;
+        if (!ok)
+            break;
+        docs[i] = malloc(len + 1);
+        assert(docs[i] != NULL);
+        ok = fread(docs[i], 1, len, in) == len;
+        docs[i][len] = 0;
+    }
+
+    uint64_t sitec = 0;
+    ok = ok && getVarint(in, &sitec);
+    for (uint64_t i = 0; i < sitec && ok; i++) {
+        uint64_t kind, doc, row, col, count;
+        ok = getVarint(in, &kind) && getVarint(in, &doc) &&
+             getVarint(in, &row) && getVarint(in, &col) &&
+             getVarint(in, &count) && kind < Pgo_kindCount && doc < docc;
+        if (!ok)
+            break;
+        SrcSpan span = {.docName = docs[doc],
+                        .start = {.row = row, .col = col}};
+        Pgo_add(p, (Pgo_Kind)kind, &span, count);
+    }
+
+    for (uint64_t i = 0; i < docc; i++)
+        free(docs[i]);
+    free(docs);
+    return ok;
+}
+
+bool Pgo_read(Pgo_Profile *p, FILE *in) {
+    char magic[sizeof PGO_MAGIC - 1];
+    for (;;) {
+        size_t n = fread(magic, 1, sizeof magic, in);
+        if (n == 0)
+            return !ferror(in);
+        if (n != sizeof magic || memcmp(magic, PGO_MAGIC, sizeof magic))
+            return false;
+        if (!readChunk(p, in))
+            return false;
+    }
+}
+
+#ifdef TESTING
+
+static SrcSpan at(char *doc, size_t row, size_t col) {
+    return (SrcSpan){.docName = doc, .start = {.row = row, .col = col}};
+}
+
+void test_table() {
+    Pgo_Profile p;
+    Pgo_init(&p);
+
+    // enough sites to grow the table a few times
+    for (size_t row = 0; row < 200; row++) {
+        SrcSpan span = at(row % 2 ? "a.l1" : "b.l1", row, 4);
+        Pgo_add(&p, Pgo_call, &span, row);
+        Pgo_add(&p, Pgo_label, &span, 1);
+    }
+    assert(p.len == 400);
+    assert(p.docc == 2);
+
+    SrcSpan span = at("a.l1", 7, 4);
+    assert(Pgo_count(&p, Pgo_call, &span) == 7);
+    Pgo_add(&p, Pgo_call, &span, 3);
+    assert(Pgo_count(&p, Pgo_call, &span) == 10);
+
+    // same position, other document or kind
+    uint64_t count;
+    SrcSpan other = at("b.l1", 7, 4);
+    assert(!Pgo_lookup(&p, Pgo_call, &other, &count));
+    assert(!Pgo_lookup(&p, Pgo_ifTaken, &span, &count));
+
+    SrcSpan unnamed = {.start = {.row = 1}};
+    Pgo_add(&p, Pgo_fnEntry, &unnamed, 0);
+    assert(Pgo_lookup(&p, Pgo_fnEntry, &unnamed, &count) && count == 0);
+
+    Pgo_free(&p);
+}
+
+void test_file() {
+    Pgo_Profile p;
+    Pgo_init(&p);
+    SrcSpan span = at("a.l1", 300, 2);
+    Pgo_add(&p, Pgo_ifEntered, &span, 1u << 20);
+    Pgo_add(&p, Pgo_ifTaken, &span, 5);
+
+    // two chunks, as left by two runs
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(Pgo_write(&p, f));
+    assert(Pgo_write(&p, f));
+    Pgo_free(&p);
+
+    rewind(f);
+    Pgo_init(&p);
+    assert(Pgo_read(&p, f));
+    assert(p.len == 2);
+    assert(Pgo_count(&p, Pgo_ifEntered, &span) == 2u << 20);
+    assert(Pgo_count(&p, Pgo_ifTaken, &span) == 10);
+    Pgo_free(&p);
+
+    // a truncated chunk
+    long size = ftell(f);
+    rewind(f);
+    char buf[128];
+    assert(fread(buf, 1, (size_t)size, f) == (size_t)size);
+    fclose(f);
+
+    f = tmpfile();
+    assert(f != NULL);
+    fwrite(buf, 1, (size_t)size - 1, f);
+    rewind(f);
+    Pgo_init(&p);
+    assert(!Pgo_read(&p, f));
+    fclose(f);
+    Pgo_free(&p);
+}
+
+int main() {
+    printf("pgo table...");
+    test_table();
+    printf("OK!\n");
+    printf("pgo file...");
+    test_file();
+    printf("OK!\n");
+}
+
+#endif
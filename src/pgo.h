@@ -0,0 +1,73 @@
+// execution counts from an instrumented build, keyed by the source span of
+// what was counted. see `CGen_Config.instrument` for how they are recorded.
+//
+// the file is a sequence of chunks, one per instrumented module and run,
+// which are summed when read. all integers are LEB128 varints:
+//
+//   "L1PROF1\n"
+//   ndocs  (len name)*
+//   nsites (kind doc row col count)*
+
+#pragma once
+
+#include "gendef.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PGO_MAGIC "L1PROF1\n"
+
+typedef enum Pgo_Kind {
+    // a function was entered, keyed by the function's span
+    Pgo_fnEntry,
+    // an `if` condition was evaluated, and found true
+    Pgo_ifEntered,
+    Pgo_ifTaken,
+    // control reached a label
+    Pgo_label,
+    // a call was made, keyed by the call's span
+    Pgo_call,
+    Pgo_kindCount,
+} Pgo_Kind;
+
+typedef struct Pgo_Site {
+    uint8_t kind;
+    uint32_t doc;
+    size_t row;
+    size_t col;
+    uint64_t count;
+} Pgo_Site;
+
+typedef struct Pgo_Profile {
+    // owned copies of the document names
+    char **docs;
+    size_t docc;
+
+    // open addressed
+    Pgo_Site *sites;
+    bool *used;
+    size_t len;
+    size_t capacity;
+} Pgo_Profile;
+
+void Pgo_init(Pgo_Profile *p);
+void Pgo_free(Pgo_Profile *p);
+
+// adds `count` to the site of `kind` starting at `span`
+void Pgo_add(Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span,
+             uint64_t count);
+
+// the count of a site. returns false if the profile has no such site, which
+// is different from a site that was never reached.
+bool Pgo_lookup(const Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span,
+                uint64_t *count);
+
+// the count of a site, 0 if it is not in the profile
+uint64_t Pgo_count(const Pgo_Profile *p, Pgo_Kind kind, const SrcSpan *span);
+
+// writes the profile as a single chunk. returns false on a write error.
+bool Pgo_write(const Pgo_Profile *p, FILE *out);
+
+// adds every chunk in `in` to `p`. returns false if the file is malformed;
+// the chunks before the bad one have been added.
+bool Pgo_read(Pgo_Profile *p, FILE *in);
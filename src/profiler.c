@@ -0,0 +1,410 @@
+#define _DEFAULT_SOURCE
+
+#include "profiler.h"
+#include "common/bytebuf.h"
+#include "common/macros.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// frames recorded per sample on average before the buffer counts as full
+#define AVG_DEPTH 16
+
+_Thread_local Prof_Stack Prof_stack;
+
+typedef struct Sample {
+    size_t first;
+    size_t depth;
+    // frames were cut off at the root
+    bool truncated;
+    // set once the sample is written in full
+    atomic_bool ready;
+} Sample;
+
+// SIGPROF can land on several threads at once, so handlers claim their
+// sample slot and frames with atomic adds and never share either. nothing is
+// read back until the timer has stopped.
+static struct {
+    Sample *samples;
+    size_t sampleCap;
+    Prof_Frame *frames;
+    size_t frameCap;
+    // slots and frames claimed so far, possibly past the end
+    atomic_size_t sampleNext;
+    atomic_size_t frameNext;
+    atomic_size_t taken;
+    atomic_size_t dropped;
+    bool running;
+    struct sigaction oldAction;
+} prof;
+
+static void onSample(int sig) {
+    (void)sig;
+    int savedErrno = errno;
+
+    size_t depth = Prof_stack.depth < 0 ? 0 : (size_t)Prof_stack.depth;
+    if (depth > PROF_MAX_DEPTH)
+        depth = PROF_MAX_DEPTH;
+    atomic_signal_fence(memory_order_acquire);
+
+    size_t n = depth > PROF_SAMPLE_DEPTH ? PROF_SAMPLE_DEPTH : depth;
+    size_t slot = atomic_fetch_add_explicit(&prof.sampleNext, 1,
+                                            memory_order_relaxed);
+    size_t first = slot < prof.sampleCap
+                       ? atomic_fetch_add_explicit(&prof.frameNext, n,
+                                                   memory_order_relaxed)
+                       : prof.frameCap;
+    if (slot >= prof.sampleCap || first + n > prof.frameCap) {
+        atomic_fetch_add_explicit(&prof.dropped, 1, memory_order_relaxed);
+        errno = savedErrno;
+        return;
+    }
+
+    memcpy(prof.frames + first, Prof_stack.frames + (depth - n),
+           n * sizeof(Prof_Frame));
+    Sample *sample = &prof.samples[slot];
+    sample->first = first;
+    sample->depth = n;
+    sample->truncated = n < depth;
+    atomic_store_explicit(&sample->ready, true, memory_order_release);
+    atomic_fetch_add_explicit(&prof.taken, 1, memory_order_relaxed);
+    errno = savedErrno;
+}
+
+static bool setTimer(unsigned hz) {
+    struct itimerval timer = {0};
+    if (hz > 0) {
+        long usec = 1000000 / hz;
+        if (usec == 0)
+            usec = 1;
+        // `tv_usec` has to stay under a second
+        timer.it_interval.tv_sec = usec / 1000000;
+        timer.it_interval.tv_usec = usec % 1000000;
+        timer.it_value = timer.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+bool Prof_start(unsigned hz, size_t maxSamples) {
+    if (prof.running || hz == 0 || maxSamples == 0)
+        return false;
+
+    Prof_reset();
+    prof.samples = calloc(maxSamples, sizeof(Sample));
+    prof.frames = malloc(maxSamples * AVG_DEPTH * sizeof(Prof_Frame));
+    if (prof.samples == NULL || prof.frames == NULL) {
+        Prof_reset();
+        return false;
+    }
+    prof.sampleCap = maxSamples;
+    prof.frameCap = maxSamples * AVG_DEPTH;
+
+    struct sigaction action = {.sa_handler = onSample, .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &prof.oldAction) != 0)
+        return false;
+    if (!setTimer(hz)) {
+        sigaction(SIGPROF, &prof.oldAction, NULL);
+        return false;
+    }
+    prof.running = true;
+    return true;
+}
+
+void Prof_stop(void) {
+    if (!prof.running)
+        return;
+    setTimer(0);
+    // a signal raised before the timer stopped may still be on its way, and
+    // by default SIGPROF kills the process, so it is ignored instead
+    struct sigaction restore = prof.oldAction;
+    if (!(restore.sa_flags & SA_SIGINFO) && restore.sa_handler == SIG_DFL) {
+        restore = (struct sigaction){.sa_handler = SIG_IGN};
+        sigemptyset(&restore.sa_mask);
+    }
+    sigaction(SIGPROF, &restore, NULL);
+    prof.running = false;
+}
+
+size_t Prof_samples(void) { return atomic_load(&prof.taken); }
+
+size_t Prof_dropped(void) { return atomic_load(&prof.dropped); }
+
+void Prof_reset(void) {
+    Prof_stop();
+    free(prof.samples);
+    free(prof.frames);
+    prof.samples = NULL;
+    prof.frames = NULL;
+    prof.sampleCap = prof.frameCap = 0;
+    atomic_store(&prof.sampleNext, 0);
+    atomic_store(&prof.frameNext, 0);
+    atomic_store(&prof.taken, 0);
+    atomic_store(&prof.dropped, 0);
+}
+
+// Folded output ///////////////////////////////////////////////////////////////
+
+static void appendFrame(ByteBuf *out, const Prof_Frame *frame) {
+    const char *name = frame->fn && frame->fn->name ? frame->fn->name : "?";
+    ByteBuf_appendArr(out, name, strlen(name));
+
+    const SrcSpan *span = frame->stmt;
+    if (span == NULL)
+        return;
+    char posn[64];
+    int n = snprintf(posn, sizeof posn, ":%zu:%zu)", span->start.row,
+                     span->start.col);
+    const char *doc = span->docName ? span->docName : "?";
+    ByteBuf_appendArr(out, " (", 2);
+    ByteBuf_appendArr(out, doc, strlen(doc));
+    ByteBuf_appendArr(out, posn, (size_t)n);
+}
+
+// the rendered stacks, NUL separated, for the comparator
+static const char *sortBase;
+
+static int compareStacks(const void *a, const void *b) {
+    return strcmp(sortBase + *(const size_t *)a, sortBase + *(const size_t *)b);
+}
+
+bool Prof_writeFolded(FILE *out) {
+    // sampling while rendering would race with the buffers
+    Prof_stop();
+    size_t slots = atomic_load(&prof.sampleNext);
+    if (slots > prof.sampleCap)
+        slots = prof.sampleCap;
+    size_t count = 0;
+    if (atomic_load(&prof.taken) == 0)
+        return true;
+
+    ByteBuf stacks;
+    ByteBuf_init(&stacks, 64 * slots);
+    size_t *offsets = malloc(slots * sizeof(size_t));
+    assert(offsets != NULL);
+
+    for (size_t i = 0; i < slots; i++) {
+        Sample *sample = &prof.samples[i];
+        // a handler that lost the race for frames leaves its slot unwritten
+        if (!atomic_load_explicit(&sample->ready, memory_order_acquire))
+            continue;
+        offsets[count++] = stacks.len;
+        if (sample->depth == 0) {
+            static const char outside[] = "[outside lang1]";
+            ByteBuf_appendArr(&stacks, outside, sizeof outside - 1);
+        } else if (sample->truncated) {
+            static const char cut[] = "[truncated];";
+            ByteBuf_appendArr(&stacks, cut, sizeof cut - 1);
+        }
+        for (size_t j = 0; j < sample->depth; j++) {
+            if (j > 0)
+                ByteBuf_append(&stacks, ';');
+            appendFrame(&stacks, &prof.frames[sample->first + j]);
+        }
+        ByteBuf_append(&stacks, 0);
+    }
+
+    sortBase = stacks.data;
+    qsort(offsets, count, sizeof(size_t), compareStacks);
+
+    bool ok = true;
+    for (size_t i = 0; i < count && ok;) {
+        const char *stack = stacks.data + offsets[i];
+        size_t j = i + 1;
+        while (j < count && !strcmp(stack, stacks.data + offsets[j]))
+            j++;
+        ok = fprintf(out, "%s %zu\n", stack, j - i) >= 0;
+        i = j;
+    }
+
+    free(offsets);
+    ByteBuf_free(&stacks);
+    return ok && !ferror(out);
+}
+
+#ifdef TESTING
+
+#include <threads.h>
+#include <time.h>
+
+static volatile uint64_t sink;
+
+// spins for `seconds` of CPU time, which is what ITIMER_PROF counts
+static void burn(double seconds) {
+    clock_t end = clock() + (clock_t)(seconds * CLOCKS_PER_SEC);
+    while (clock() < end) {
+        for (int i = 0; i < 1000; i++)
+            sink += (uint64_t)i * i;
+    }
+}
+
+static char *readAll(FILE *f) {
+    static char buf[4096];
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof buf - 1, f);
+    buf[n] = 0;
+    return buf;
+}
+
+void test_hooks() {
+    Decl_Fn outer = {.name = "_outer"};
+    SrcSpan span = {.docName = "t.l1", .start = {.row = 3, .col = 4}};
+
+    assert(Prof_stack.depth == 0);
+    Prof_stmt(&span); // outside any function, ignored
+    Prof_enter(&outer);
+    assert(Prof_stack.depth == 1);
+    assert(Prof_stack.frames[0].fn == &outer);
+    assert(Prof_stack.frames[0].stmt == NULL);
+    Prof_stmt(&span);
+    assert(Prof_stack.frames[0].stmt == &span);
+    Prof_leave();
+    assert(Prof_stack.depth == 0);
+
+    // past the shadow stack only the depth is tracked
+    for (int i = 0; i < PROF_MAX_DEPTH + 2; i++) {
+        Prof_enter(&outer);
+    }
+    Prof_stmt(&span);
+    for (int i = 0; i < PROF_MAX_DEPTH + 2; i++) {
+        Prof_leave();
+    }
+    assert(Prof_stack.depth == 0);
+}
+
+void test_sampling() {
+    Decl_Fn outer = {.name = "_outer"};
+    Decl_Fn inner = {.name = "_inner"};
+    SrcSpan call = {.docName = "t.l1", .start = {.row = 1, .col = 4}};
+    SrcSpan loop = {.docName = "t.l1", .start = {.row = 6, .col = 8}};
+
+    assert(Prof_start(1000, 4096));
+    Prof_enter(&outer);
+    Prof_stmt(&call);
+    Prof_enter(&inner);
+    Prof_stmt(&loop);
+    burn(0.2);
+    Prof_leave();
+    Prof_leave();
+    Prof_stop();
+
+    assert(Prof_samples() > 20);
+    assert(Prof_dropped() == 0);
+
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(Prof_writeFolded(f));
+    char *folded = readAll(f);
+    fclose(f);
+
+    const char *stack = "_outer (t.l1:1:4);_inner (t.l1:6:8) ";
+    char *line = strstr(folded, stack);
+    assert(line != NULL);
+    assert(atoi(line + strlen(stack)) > 0);
+    Prof_reset();
+    assert(Prof_samples() == 0);
+}
+
+void test_dropped() {
+    Decl_Fn fn = {.name = "_f"};
+
+    assert(Prof_start(1000, 4));
+    Prof_enter(&fn);
+    burn(0.05);
+    Prof_leave();
+    Prof_stop();
+
+    assert(Prof_samples() == 4);
+    assert(Prof_dropped() > 0);
+
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(Prof_writeFolded(f));
+    assert(!strcmp(readAll(f), "_f 4\n"));
+    fclose(f);
+    Prof_reset();
+}
+
+void test_slow_rate() {
+    // a whole second between samples
+    assert(Prof_start(1, 4));
+    Prof_stop();
+    Prof_reset();
+}
+
+void test_late_signal() {
+    // a SIGPROF that arrives after stopping must not end the process
+    signal(SIGPROF, SIG_DFL);
+    assert(Prof_start(1000, 4));
+    Prof_stop();
+    raise(SIGPROF);
+
+    struct sigaction now;
+    assert(sigaction(SIGPROF, NULL, &now) == 0);
+    assert(now.sa_handler == SIG_IGN);
+    Prof_reset();
+}
+
+static int burnIn(void *arg) {
+    Prof_enter(arg);
+    burn(0.2);
+    Prof_leave();
+    return 0;
+}
+
+void test_threads() {
+    Decl_Fn a = {.name = "_a"};
+    Decl_Fn b = {.name = "_b"};
+
+    // both threads take samples, at times at once
+    assert(Prof_start(2000, 8192));
+    thrd_t threads[2];
+    assert(thrd_create(&threads[0], burnIn, &a) == thrd_success);
+    assert(thrd_create(&threads[1], burnIn, &b) == thrd_success);
+    thrd_join(threads[0], NULL);
+    thrd_join(threads[1], NULL);
+    Prof_stop();
+    assert(Prof_samples() > 20);
+
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(Prof_writeFolded(f));
+    rewind(f);
+
+    // every sample is one of the two stacks, or taken between them
+    char stack[64];
+    size_t n, total = 0;
+    while (fscanf(f, "%63[^0-9] %zu\n", stack, &n) == 2) {
+        assert(!strcmp(stack, "_a ") || !strcmp(stack, "_b ") ||
+               !strcmp(stack, "[outside lang1] "));
+        total += n;
+    }
+    assert(feof(f));
+    assert(total == Prof_samples());
+    fclose(f);
+    Prof_reset();
+}
+
+int main() {
+    printf("prof hooks...");
+    test_hooks();
+    printf("OK!\n");
+    printf("prof sampling...");
+    test_sampling();
+    printf("OK!\n");
+    printf("prof dropped...");
+    test_dropped();
+    printf("OK!\n");
+    printf("prof slow rate...");
+    test_slow_rate();
+    printf("OK!\n");
+    printf("prof late signal...");
+    test_late_signal();
+    printf("OK!\n");
+    printf("prof threads...");
+    test_threads();
+    printf("OK!\n");
+}
+
+#endif
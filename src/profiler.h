@@ -0,0 +1,80 @@
+// a sampling profiler for running lang1 code. whatever executes lang1 keeps a
+// shadow call stack with `Prof_enter()`, `Prof_stmt()` and `Prof_leave()`;
+// while the profiler runs, a timer signal copies that stack out at a fixed
+// rate. the samples are written as folded stacks, one line per distinct
+// stack, which flamegraph tools read directly:
+//
+//   _main (a.l1:12:4);_step (a.l1:3:8) 117
+
+#pragma once
+
+#include "ast.h"
+#include "gendef.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// frames kept on the shadow stack; deeper calls are counted but not recorded
+#define PROF_MAX_DEPTH 256
+
+// frames kept per sample, the innermost ones win
+#define PROF_SAMPLE_DEPTH 64
+
+typedef struct Prof_Frame {
+    const Decl_Fn *fn;
+    // the statement currently executing in `fn`, NULL before the first one
+    const SrcSpan *stmt;
+} Prof_Frame;
+
+typedef struct Prof_Stack {
+    Prof_Frame frames[PROF_MAX_DEPTH];
+    // only ever changed by its own thread, read from the signal handler
+    volatile sig_atomic_t depth;
+} Prof_Stack;
+
+extern _Thread_local Prof_Stack Prof_stack;
+
+// the hooks cost a couple of stores whether or not the profiler is running,
+// so the shadow stack is always complete when it starts.
+
+static inline void Prof_enter(const Decl_Fn *fn) {
+    sig_atomic_t depth = Prof_stack.depth;
+    if (depth < PROF_MAX_DEPTH)
+        Prof_stack.frames[depth] = (Prof_Frame){.fn = fn};
+    // the frame has to be in place before a sample can see it
+    atomic_signal_fence(memory_order_release);
+    Prof_stack.depth = depth + 1;
+}
+
+static inline void Prof_stmt(const SrcSpan *stmt) {
+    sig_atomic_t depth = Prof_stack.depth;
+    if (depth > 0 && depth <= PROF_MAX_DEPTH)
+        Prof_stack.frames[depth - 1].stmt = stmt;
+}
+
+static inline void Prof_leave(void) { Prof_stack.depth -= 1; }
+
+// starts sampling every thread's shadow stack `hz` times a second of CPU
+// time, keeping room for `maxSamples` samples. the signal may reach several
+// threads at once, and each claims its own room in the buffers. returns
+// false if the timer or signal handler could not be installed.
+bool Prof_start(unsigned hz, size_t maxSamples);
+
+// stops sampling. the samples are kept until `Prof_reset()`. the SIGPROF
+// action from before `Prof_start()` is put back, except that the default,
+// which ends the process, becomes SIG_IGN so a sample still in flight is
+// dropped.
+void Prof_stop(void);
+
+// writes the samples taken so far in folded stack format. returns false on
+// a write error.
+bool Prof_writeFolded(FILE *out);
+
+// number of samples taken, and dropped because the buffer was full
+size_t Prof_samples(void);
+size_t Prof_dropped(void);
+
+// frees the samples
+void Prof_reset(void);
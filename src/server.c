@@ -0,0 +1,450 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+#include "common/bytebuf.h"
+#include "common/macros.h"
+#include "tokbuf.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define INITIAL_CAPACITY 64
+
+// FNV-1a
+static uint64_t hashBytes(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+void Server_init(Server *s) {
+    *s = (Server){
+        .entries = calloc(INITIAL_CAPACITY, sizeof(Server_Entry)),
+        .capacity = INITIAL_CAPACITY,
+        .timeoutMs = SERVER_DEFAULT_TIMEOUT_MS,
+    };
+    assert(s->entries != NULL);
+    ByteBuf_init(&s->src, 4096);
+}
+
+void Server_cleanup(Server *s) {
+    for (size_t i = 0; i < s->capacity; i++) {
+        if (s->entries[i].path != NULL) {
+            free(s->entries[i].path);
+            TokBuf_free(&s->entries[i].toks);
+        }
+    }
+    free(s->entries);
+    ByteBuf_free(&s->src);
+    *s = (Server){0};
+}
+
+static Server_Entry *findSlot(Server_Entry *entries, size_t capacity,
+                              const char *path) {
+    size_t mask = capacity - 1;
+    size_t i = hashBytes(path, strlen(path)) & mask;
+    while (entries[i].path != NULL && strcmp(entries[i].path, path))
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+static void grow(Server *s) {
+    size_t capacity = s->capacity * 2;
+    Server_Entry *entries = calloc(capacity, sizeof(Server_Entry));
+    assert(entries != NULL);
+
+    for (size_t i = 0; i < s->capacity; i++) {
+        if (s->entries[i].path != NULL)
+            *findSlot(entries, capacity, s->entries[i].path) = s->entries[i];
+    }
+    free(s->entries);
+    s->entries = entries;
+    s->capacity = capacity;
+}
+
+static Server_Entry *lookup(Server *s, const char *path) {
+    Server_Entry *e = findSlot(s->entries, s->capacity, path);
+    if (e->path != NULL)
+        return e;
+
+    if ((s->count + 1) * 4 > s->capacity * 3) {
+        grow(s);
+        e = findSlot(s->entries, s->capacity, path);
+    }
+
+    size_t len = strlen(path) + 1;
+    *e = (Server_Entry){.path = malloc(len)};
+    assert(e->path != NULL);
+    memcpy(e->path, path, len);
+    TokBuf_init(&e->toks);
+    s->count += 1;
+    return e;
+}
+
+// reads the whole of `path` into `buf`
+static bool readFile(const char *path, ByteBuf *buf) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+
+    buf->len = 0;
+    for (;;) {
+        // doubling keeps big files linear
+        if (buf->capacity - buf->len < 4096)
+            ByteBuf_ensure(buf, buf->capacity * 2 + 4096);
+        size_t n = fread(buf->data + buf->len, 1, buf->capacity - buf->len, f);
+        buf->len += n;
+        if (n == 0)
+            break;
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// formats straight into `reply`, however long the line gets
+static void appendf(ByteBuf *reply, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len <= 0)
+        return;
+
+    ByteBuf_ensure(reply, reply->len + (size_t)len + 1);
+    va_start(args, fmt);
+    vsnprintf(reply->data + reply->len, (size_t)len + 1, fmt, args);
+    va_end(args);
+    reply->len += (size_t)len;
+}
+
+static void compile(Server *s, const char *path, ByteBuf *reply) {
+    if (!readFile(path, &s->src)) {
+        appendf(reply, "error %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    uint64_t hash = hashBytes(s->src.data, s->src.len);
+    Server_Entry *e = lookup(s, path);
+
+    bool hit = e->hash == hash && e->toks.kinds != NULL;
+    if (hit) {
+        s->hits += 1;
+    } else {
+        // the old token arrays are reused, so a changed file usually costs
+        // no allocation at all
+        s->misses += 1;
+        e->hash = hash;
+        e->ok = TokBuf_lex(&e->toks, s->src.data, s->src.len, s->threads);
+    }
+
+    if (e->ok)
+        appendf(reply, "ok %zu %s\n", e->toks.len, hit ? "hit" : "miss");
+    else
+        appendf(reply, "error %s:%zu: unexpected character\n", path,
+                e->toks.errOffset);
+}
+
+bool Server_handle(Server *s, const char *request, ByteBuf *reply) {
+    reply->len = 0;
+
+    if (!strcmp(request, "quit")) {
+        ByteBuf_appendArr(reply, "ok\n", 3);
+        return false;
+    }
+
+    const char prefix[] = "compile ";
+    if (!strncmp(request, prefix, sizeof prefix - 1)) {
+        compile(s, request + sizeof prefix - 1, reply);
+        return true;
+    }
+
+    appendf(reply, "error unknown request\n");
+    return true;
+}
+
+static bool socketAddr(struct sockaddr_un *addr, const char *sockPath) {
+    *addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (strlen(sockPath) >= sizeof addr->sun_path)
+        return false;
+    strcpy(addr->sun_path, sockPath);
+    return true;
+}
+
+static bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// reads from `fd` into `buf` until EOF, or until a newline if `line` is set.
+static void readAll(int fd, ByteBuf *buf, bool line) {
+    buf->len = 0;
+    for (;;) {
+        if (buf->capacity - buf->len < 256)
+            ByteBuf_ensure(buf, buf->capacity * 2 + 256);
+        ssize_t n = read(fd, buf->data + buf->len, buf->capacity - buf->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        buf->len += (size_t)n;
+        if (line && memchr(buf->data, '\n', buf->len) != NULL)
+            break;
+    }
+}
+
+// removes a socket left behind at `path`. fails if something else is there.
+static bool removeStale(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) < 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return false;
+    }
+    return unlink(path) == 0;
+}
+
+static void setTimeout(int fd, unsigned ms) {
+    struct timeval tv = {.tv_sec = ms / 1000, .tv_usec = ms % 1000 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+bool Server_listen(Server *s, const char *sockPath) {
+    struct sockaddr_un addr;
+    if (!socketAddr(&addr, sockPath))
+        return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    if (!removeStale(sockPath) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+        listen(fd, 16) < 0) {
+        close(fd);
+        return false;
+    }
+
+    ByteBuf request, reply;
+    ByteBuf_init(&request, 256);
+    ByteBuf_init(&reply, 256);
+
+    bool running = true;
+    while (running) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // a client that stalls is timed out and dropped
+        setTimeout(conn, s->timeoutMs);
+        readAll(conn, &request, true);
+        char *end = memchr(request.data, '\n', request.len);
+        if (end != NULL) {
+            *end = 0;
+            running = Server_handle(s, request.data, &reply);
+            writeAll(conn, reply.data, reply.len);
+        }
+        close(conn);
+    }
+
+    ByteBuf_free(&request);
+    ByteBuf_free(&reply);
+    close(fd);
+    unlink(sockPath);
+    return true;
+}
+
+bool Server_request(const char *sockPath, const char *request,
+                    ByteBuf *reply) {
+    struct sockaddr_un addr;
+    if (!socketAddr(&addr, sockPath))
+        return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+
+    bool ok = connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0 &&
+              writeAll(fd, request, strlen(request)) && writeAll(fd, "\n", 1);
+    if (ok)
+        readAll(fd, reply, false);
+
+    close(fd);
+    return ok;
+}
+
+#ifdef TESTING
+
+#include <threads.h>
+
+static void writeFile(const char *path, const char *contents) {
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+}
+
+static bool replyIs(ByteBuf *reply, const char *want) {
+    return reply->len == strlen(want) && !memcmp(reply->data, want, reply->len);
+}
+
+void test_cache() {
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/lang1_server_%d.l1", (int)getpid());
+    char request[128];
+    snprintf(request, sizeof request, "compile %s", path);
+
+    Server s;
+    Server_init(&s);
+    ByteBuf reply;
+    ByteBuf_init(&reply, 64);
+
+    writeFile(path, "fn _f() int { return 1; }");
+    assert(Server_handle(&s, request, &reply));
+    assert(replyIs(&reply, "ok 10 miss\n"));
+
+    assert(Server_handle(&s, request, &reply));
+    assert(replyIs(&reply, "ok 10 hit\n"));
+
+    // a change in content invalidates the entry
+    writeFile(path, "fn _f() int { return 1 + 2; }");
+    assert(Server_handle(&s, request, &reply));
+    assert(replyIs(&reply, "ok 12 miss\n"));
+
+    writeFile(path, "fn _f() $");
+    assert(Server_handle(&s, request, &reply));
+    assert(reply.len > 0 && !memcmp(reply.data, "error ", 6));
+
+    // replies are not cut short, however long the path
+    char longRequest[8192] = "compile /tmp/";
+    memset(longRequest + 13, 'x', sizeof longRequest - 14);
+    assert(Server_handle(&s, longRequest, &reply));
+    assert(reply.len > sizeof longRequest && !memcmp(reply.data, "error ", 6));
+    assert(reply.data[reply.len - 1] == '\n');
+
+    assert(s.hits == 1 && s.misses == 3 && s.count == 1);
+    assert(!Server_handle(&s, "quit", &reply));
+
+    unlink(path);
+    ByteBuf_free(&reply);
+    Server_cleanup(&s);
+}
+
+static char sockPath[64];
+
+static int serve(void *arg) {
+    Server *s = arg;
+    return Server_listen(s, sockPath) ? 0 : 1;
+}
+
+void test_socket() {
+    snprintf(sockPath, sizeof sockPath, "/tmp/lang1_server_%d.sock",
+             (int)getpid());
+
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/lang1_server_%d.l1", (int)getpid());
+    char request[128];
+    snprintf(request, sizeof request, "compile %s", path);
+    writeFile(path, "var _x: int = 3;");
+
+    // a stale socket from an earlier run is replaced
+    struct sockaddr_un addr;
+    assert(socketAddr(&addr, sockPath));
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(stale >= 0);
+    assert(bind(stale, (struct sockaddr *)&addr, sizeof addr) == 0);
+    close(stale);
+
+    Server s;
+    Server_init(&s);
+    s.timeoutMs = 50;
+    thrd_t thread;
+    assert(thrd_create(&thread, serve, &s) == thrd_success);
+
+    ByteBuf reply;
+    ByteBuf_init(&reply, 64);
+
+    // wait for the server to come up
+    int tries = 0;
+    while (!Server_request(sockPath, request, &reply)) {
+        assert(++tries < 1000);
+        thrd_sleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    }
+    assert(replyIs(&reply, "ok 7 miss\n"));
+
+    // a client that never sends its request only holds others up until it
+    // times out
+    int quiet = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(quiet >= 0);
+    assert(connect(quiet, (struct sockaddr *)&addr, sizeof addr) == 0);
+
+    assert(Server_request(sockPath, request, &reply));
+    assert(replyIs(&reply, "ok 7 hit\n"));
+    close(quiet);
+
+    assert(Server_request(sockPath, "quit", &reply));
+    assert(replyIs(&reply, "ok\n"));
+
+    int result;
+    thrd_join(thread, &result);
+    assert(result == 0);
+
+    unlink(path);
+    ByteBuf_free(&reply);
+    Server_cleanup(&s);
+}
+
+void test_not_socket() {
+    // anything but a socket at the path is left alone
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/lang1_server_%d.keep", (int)getpid());
+    writeFile(path, "keep me");
+
+    Server s;
+    Server_init(&s);
+    assert(!Server_listen(&s, path));
+    Server_cleanup(&s);
+
+    FILE *f = fopen(path, "rb");
+    assert(f != NULL);
+    fclose(f);
+    unlink(path);
+}
+
+int main() {
+    printf("server cache...");
+    test_cache();
+    printf("OK!\n");
+    printf("server socket...");
+    test_socket();
+    printf("OK!\n");
+    printf("server not socket...");
+    test_not_socket();
+    printf("OK!\n");
+}
+
+#endif
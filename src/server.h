@@ -0,0 +1,63 @@
+// a long running compile server. keeps the front-end results for every file
+// it has seen in memory, keyed by path, and only redoes the work when the
+// content hash of a file changes.
+//
+// protocol, one request per connection over a unix stream socket:
+//   "compile <path>\n" -> "ok <tokens> hit|miss\n" or "error <message>\n"
+//   "quit\n"           -> "ok\n", then the server stops
+
+#pragma once
+
+#include "common/bytebuf.h"
+#include "tokbuf.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERVER_DEFAULT_TIMEOUT_MS 5000
+
+typedef struct Server_Entry {
+    // NULL for an empty slot
+    char *path;
+    uint64_t hash;
+
+    bool ok;
+    TokBuf toks;
+} Server_Entry;
+
+typedef struct Server {
+    // open addressed, `capacity` is a power of two
+    Server_Entry *entries;
+    size_t capacity;
+    size_t count;
+
+    // scratch space for file contents, kept around between requests
+    ByteBuf src;
+
+    // threads to lex each file with, 0 for one per core
+    unsigned threads;
+
+    // how long `Server_listen()` waits on a quiet client before dropping it,
+    // so one stuck connection cannot hold up the rest.
+    // `SERVER_DEFAULT_TIMEOUT_MS` after `Server_init()`.
+    unsigned timeoutMs;
+
+    size_t hits;
+    size_t misses;
+} Server;
+
+void Server_init(Server *s);
+void Server_cleanup(Server *s);
+
+// handles a single request line, writing the response line into `reply`.
+// returns false if the request asks the server to stop.
+bool Server_handle(Server *s, const char *request, ByteBuf *reply);
+
+// serves requests on a unix socket at `sockPath` until a "quit" request
+// comes in. a socket left at `sockPath` by an earlier server is replaced, but
+// any other kind of file is not. returns false if the socket could not be set
+// up.
+bool Server_listen(Server *s, const char *sockPath);
+
+// sends one request to the server at `sockPath` and reads the reply.
+bool Server_request(const char *sockPath, const char *request, ByteBuf *reply);
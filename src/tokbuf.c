@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tokbuf.h"
+#include "common/macros.h"
+#include "lexer.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+// upper bound on chunks, and so on threads, for a single buffer.
+#define MAX_CHUNKS 64
+
+typedef struct MemReader {
+    const char *data;
+    size_t len;
+    size_t offset;
+} MemReader;
+
+static int memReadChar(void *context) {
+    MemReader *r = context;
+    if (r->offset < r->len)
+        return (unsigned char)r->data[r->offset++];
+    return EOF;
+}
+
+typedef struct Chunk {
+    const char *src;
+    size_t base;
+    size_t len;
+
+    TokBuf toks;
+    bool ok;
+} Chunk;
+
+void TokBuf_init(TokBuf *buf) { *buf = (TokBuf){0}; }
+
+void TokBuf_free(TokBuf *buf) {
+    free(buf->kinds);
+    free(buf->starts);
+    free(buf->lens);
+    *buf = (TokBuf){0};
+}
+
+static void reserve(TokBuf *buf, size_t capacity) {
+    if (buf->capacity >= capacity)
+        return;
+    buf->kinds = realloc(buf->kinds, capacity * sizeof *buf->kinds);
+    buf->starts = realloc(buf->starts, capacity * sizeof *buf->starts);
+    buf->lens = realloc(buf->lens, capacity * sizeof *buf->lens);
+    assert(buf->kinds != NULL && buf->starts != NULL && buf->lens != NULL);
+    buf->capacity = capacity;
+}
+
+// lexes one chunk into its own buffer, with offsets relative to the whole
+// input.
+static int lexChunk(void *arg) {
+    Chunk *c = arg;
+    MemReader reader = {.data = c->src + c->base, .len = c->len};
+
+    Lexer lex;
+    Lexer_init(&lex);
+    lex.context = &reader;
+    lex.readChar = memReadChar;
+
+    // a rough guess of one token per four bytes saves most of the regrowth
+    TokBuf_init(&c->toks);
+    reserve(&c->toks, c->len / 4 + 16);
+
+    c->ok = true;
+    for (;;) {
+        Token tok = Lexer_next(&lex);
+        if (tok == EOF)
+            break;
+        if ERROR (tok) {
+            c->toks.errOffset = c->base + lex.startOffset;
+            c->ok = false;
+            break;
+        }
+
+        if (c->toks.len == c->toks.capacity)
+            reserve(&c->toks, c->toks.capacity * 2);
+
+        c->toks.kinds[c->toks.len] = (uint8_t)tok;
+        c->toks.starts[c->toks.len] = (uint32_t)(c->base + lex.startOffset);
+        c->toks.lens[c->toks.len] = (uint32_t)(lex.consumed - lex.startOffset);
+        c->toks.len += 1;
+    }
+
+    Lexer_cleanup(&lex);
+    return 0;
+}
+
+// splits `src` into at most `n` chunks, each ending just before a whitespace
+// byte. returns the number of chunks.
+static size_t split(Chunk *chunks, size_t n, const char *src, size_t len) {
+    size_t count = 0;
+    size_t start = 0;
+    for (size_t i = 1; i <= n && start < len; i++) {
+        size_t end = i == n ? len : len / n * i;
+        if (end < start)
+            end = start;
+        while (end < len && !isspace((unsigned char)src[end]))
+            end++;
+
+        chunks[count++] =
+            (Chunk){.src = src, .base = start, .len = end - start};
+        start = end;
+    }
+    return count;
+}
+
+static unsigned onlineCores(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+bool TokBuf_lex(TokBuf *buf, const char *src, size_t len, unsigned threads) {
+    assert(len <= UINT32_MAX);
+
+    if (threads == 0)
+        threads = onlineCores();
+    size_t n = len / TOKBUF_MIN_CHUNK;
+    if (n > threads)
+        n = threads;
+    if (n > MAX_CHUNKS)
+        n = MAX_CHUNKS;
+    if (n == 0)
+        n = 1;
+
+    Chunk chunks[MAX_CHUNKS];
+    thrd_t workers[MAX_CHUNKS];
+    bool started[MAX_CHUNKS] = {0};
+    n = split(chunks, n, src, len);
+
+    // the calling thread takes the first chunk itself
+    for (size_t i = 1; i < n; i++)
+        started[i] =
+            thrd_create(&workers[i], lexChunk, &chunks[i]) == thrd_success;
+    if (n > 0)
+        lexChunk(&chunks[0]);
+    for (size_t i = 1; i < n; i++) {
+        if (started[i])
+            thrd_join(workers[i], NULL);
+        else
+            lexChunk(&chunks[i]);
+    }
+
+    // stitch the chunks together, stopping at the first one that failed.
+    // chunk boundaries fall on whitespace, so no token spans two chunks.
+    size_t total = 0;
+    size_t used = 0;
+    while (used < n) {
+        total += chunks[used].toks.len;
+        if (!chunks[used++].ok)
+            break;
+    }
+
+    buf->len = 0;
+    reserve(buf, total + 1);
+    bool ok = true;
+    for (size_t i = 0; i < used; i++) {
+        TokBuf *t = &chunks[i].toks;
+        memcpy(buf->kinds + buf->len, t->kinds, t->len * sizeof *t->kinds);
+        memcpy(buf->starts + buf->len, t->starts, t->len * sizeof *t->starts);
+        memcpy(buf->lens + buf->len, t->lens, t->len * sizeof *t->lens);
+        buf->len += t->len;
+        if (!chunks[i].ok) {
+            buf->errOffset = t->errOffset;
+            ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        TokBuf_free(&chunks[i].toks);
+    return ok;
+}
+
+#ifdef TESTING
+
+#define TEST_REPEAT 20000
+
+static const char pattern[] =
+    "export fn _f(_a: int) int { if (_a >= 10) return _a+42; }\n";
+
+static char *makeInput(size_t *len) {
+    char *input = malloc(sizeof pattern * TEST_REPEAT);
+    *len = 0;
+    for (int i = 0; i < TEST_REPEAT; i++) {
+        memcpy(&input[*len], pattern, sizeof pattern - 1);
+        *len += sizeof pattern - 1;
+    }
+    return input;
+}
+
+void test_serial() {
+    const char src[] = "fn _x() { _y >= 12; }";
+    const Token want[] = {Token_fn,     Token_ident,  Token_lParen,
+                          Token_rParen, Token_lBrace, Token_ident,
+                          Token_gtEq,   Token_decLit, Token_semi,
+                          Token_rBrace};
+
+    TokBuf buf;
+    TokBuf_init(&buf);
+    assert(TokBuf_lex(&buf, src, sizeof src - 1, 1));
+    assert(buf.len == sizeof want / sizeof *want);
+
+    for (size_t i = 0; i < buf.len; i++) {
+        assert(TokBuf_kind(&buf, i) == want[i]);
+    }
+    assert(TokBuf_kind(&buf, buf.len) == EOF);
+
+    // `_y`, `>=` and `12`
+    assert(buf.starts[5] == 10 && buf.lens[5] == 2);
+    assert(buf.starts[6] == 13 && buf.lens[6] == 2);
+    assert(buf.starts[7] == 16 && buf.lens[7] == 2);
+
+    TokBuf_free(&buf);
+}
+
+void test_parallel() {
+    size_t len;
+    char *input = makeInput(&len);
+
+    TokBuf serial, parallel;
+    TokBuf_init(&serial);
+    TokBuf_init(&parallel);
+    assert(TokBuf_lex(&serial, input, len, 1));
+    assert(TokBuf_lex(&parallel, input, len, 4));
+
+    assert(serial.len == parallel.len);
+    assert(!memcmp(serial.kinds, parallel.kinds, serial.len));
+    assert(!memcmp(serial.starts, parallel.starts,
+                   serial.len * sizeof *serial.starts));
+    assert(!memcmp(serial.lens, parallel.lens,
+                   serial.len * sizeof *serial.lens));
+
+    TokBuf_free(&serial);
+    TokBuf_free(&parallel);
+    free(input);
+}
+
+void test_error() {
+    size_t len;
+    char *input = makeInput(&len);
+    size_t bad = len - len / 3;
+    while (input[bad] != '_')
+        bad++;
+    input[bad] = '$';
+
+    TokBuf buf;
+    TokBuf_init(&buf);
+    assert(!TokBuf_lex(&buf, input, len, 4));
+    assert(buf.errOffset == bad);
+    assert(buf.starts[buf.len - 1] < bad);
+
+    TokBuf_free(&buf);
+    free(input);
+}
+
+int main() {
+    printf("tokbuf serial...");
+    test_serial();
+    printf("OK!\n");
+    printf("tokbuf parallel...");
+    test_parallel();
+    printf("OK!\n");
+    printf("tokbuf error...");
+    test_error();
+    printf("OK!\n");
+}
+
+#endif
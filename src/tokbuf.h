@@ -0,0 +1,45 @@
+// whole-buffer tokenization into struct-of-arrays form. since lang1 has no
+// strings or comments, any whitespace byte is a token boundary, so large
+// inputs are split into chunks and lexed in parallel.
+
+#pragma once
+
+#include "lexer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// inputs smaller than this are never split across threads.
+#define TOKBUF_MIN_CHUNK (64 * 1024)
+
+typedef struct TokBuf {
+    // number of tokens, not counting the implicit EOF at the end.
+    size_t len;
+    size_t capacity;
+
+    // `Token` values, one byte each.
+    uint8_t *kinds;
+    // byte offset of each token into the input.
+    uint32_t *starts;
+    // byte length of each token.
+    uint32_t *lens;
+
+    // byte offset of the first character that could not be lexed. only
+    // meaningful after `TokBuf_lex()` has failed.
+    size_t errOffset;
+} TokBuf;
+
+void TokBuf_init(TokBuf *buf);
+void TokBuf_free(TokBuf *buf);
+
+// tokenizes `src[0..len)` into `buf`, replacing its contents. uses up to
+// `threads` threads, or one per online core if `threads` is 0. returns false
+// and sets `buf->errOffset` on an unexpected character, in which case `buf`
+// holds the tokens before it. inputs must be under 4GiB.
+bool TokBuf_lex(TokBuf *buf, const char *src, size_t len, unsigned threads);
+
+// the kind of token `i`, or EOF past the end.
+static inline Token TokBuf_kind(const TokBuf *buf, size_t i) {
+    return i < buf->len ? (Token)buf->kinds[i] : (Token)EOF;
+}
@@ -0,0 +1,283 @@
+#include "tokring.h"
+#include "common/bytebuf.h"
+#include "common/macros.h"
+#include "common/mem/slab.h"
+#include "lexer.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// spins this many times on an empty or full ring before yielding the thread.
+#define SPIN_LIMIT 64
+
+static void publishHead(TokRing *ring) {
+    atomic_store_explicit(&ring->head, ring->pushed, memory_order_release);
+}
+
+static void publishTail(TokRing *ring) {
+    atomic_store_explicit(&ring->tail, ring->popped, memory_order_release);
+}
+
+// returns false if the consumer closed the ring while we were waiting.
+static bool waitForSpace(TokRing *ring) {
+    const size_t capacity = ring->mask + 1;
+    if (ring->pushed - ring->cachedTail < capacity)
+        return true;
+
+    // make sure the consumer can see everything we have before blocking on it
+    publishHead(ring);
+    for (unsigned spins = 0;; spins++) {
+        ring->cachedTail =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (ring->pushed - ring->cachedTail < capacity)
+            return true;
+        if (atomic_load_explicit(&ring->closed, memory_order_relaxed))
+            return false;
+        if (spins > SPIN_LIMIT)
+            thrd_yield();
+    }
+}
+
+static int produce(void *arg) {
+    TokRing *ring = arg;
+    Lexer *lex = ring->lex;
+
+    for (;;) {
+        Token tok = Lexer_next(lex);
+        if (!waitForSpace(ring))
+            return 0;
+
+        TokSlot *slot = &ring->slots[ring->pushed & ring->mask];
+        *slot = (TokSlot){
+            .tok = tok,
+            .startRow = (uint32_t)lex->startPosn.row,
+            .startCol = (uint32_t)lex->startPosn.col,
+            .endRow = (uint32_t)lex->curPosn.row,
+            .endCol = (uint32_t)lex->curPosn.col,
+        };
+        if (lex->tokenValue != NULL) {
+            size_t len = strlen(lex->tokenValue);
+            char *dest = slot->value.bytes;
+            if (len > TOKRING_INLINE) {
+                dest = slot->value.heap = Mem_alloc(&slabAlloc, len);
+                assert(dest != NULL);
+            }
+            memcpy(dest, lex->tokenValue, len);
+            slot->len = (uint32_t)len;
+        }
+
+        ring->pushed += 1;
+
+        // EOF or a lex error ends the stream
+        if ERROR (tok) {
+            publishHead(ring);
+            return 0;
+        }
+        if (ring->pushed % TOKRING_BATCH == 0)
+            publishHead(ring);
+    }
+}
+
+bool TokRing_start(TokRing *ring, Lexer *lex, size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity)
+        cap *= 2;
+
+    *ring = (TokRing){
+        .lex = lex,
+        .mask = cap - 1,
+        .slots = malloc(cap * sizeof(TokSlot)),
+    };
+    atomic_init(&ring->closed, false);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    if (ring->slots == NULL)
+        return false;
+
+    if (thrd_create(&ring->thread, produce, ring) != thrd_success) {
+        free(ring->slots);
+        ring->slots = NULL;
+        return false;
+    }
+    return true;
+}
+
+void TokRing_cleanup(TokRing *ring) {
+    if (ring->slots == NULL)
+        return;
+
+    atomic_store_explicit(&ring->closed, true, memory_order_relaxed);
+    thrd_join(ring->thread, NULL);
+
+    // values of tokens pushed but never popped
+    for (size_t i = ring->popped; i != ring->pushed; i++) {
+        TokSlot *slot = &ring->slots[i & ring->mask];
+        if (slot->len > TOKRING_INLINE)
+            Mem_free(&slabAlloc, slot->value.heap);
+    }
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+static void slotPosns(const TokSlot *slot, SrcPosn *start, SrcPosn *end) {
+    *start = (SrcPosn){.row = slot->startRow, .col = slot->startCol};
+    *end = (SrcPosn){.row = slot->endRow, .col = slot->endCol};
+}
+
+Token TokRing_pop(TokRing *ring, SrcPosn *start, SrcPosn *end,
+                  ByteBuf *value) {
+    if (ring->done) {
+        slotPosns(&ring->last, start, end);
+        value->len = 0;
+        return ring->last.tok;
+    }
+
+    if (ring->popped == ring->cachedHead) {
+        // out of cached tokens: hand back the slots we have finished with and
+        // pick up the next batch.
+        publishTail(ring);
+        for (unsigned spins = 0;; spins++) {
+            ring->cachedHead =
+                atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (ring->popped != ring->cachedHead)
+                break;
+            if (spins > SPIN_LIMIT)
+                thrd_yield();
+        }
+    }
+
+    TokSlot *slot = &ring->slots[ring->popped & ring->mask];
+    Token tok = slot->tok;
+    slotPosns(slot, start, end);
+    value->len = 0;
+    if (slot->len > 0) {
+        bool heap = slot->len > TOKRING_INLINE;
+        const char *bytes = heap ? slot->value.heap : slot->value.bytes;
+        ByteBuf_appendArr(value, bytes, slot->len);
+        ByteBuf_append(value, 0);
+        if (heap)
+            Mem_free(&slabAlloc, slot->value.heap);
+    }
+
+    if ERROR (tok) {
+        ring->done = true;
+        ring->last = *slot;
+    }
+
+    ring->popped += 1;
+    if (ring->popped % TOKRING_BATCH == 0)
+        publishTail(ring);
+
+    return tok;
+}
+
+#ifdef TESTING
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_REPEAT 2000
+
+// `_argument` is too long to be kept in a slot
+static const char pattern[] =
+    "export fn _f(_argument: int) int { return _argument + 42; }\n";
+static char input[sizeof pattern * TEST_REPEAT];
+
+static void initInput(TestLexer_ReadCtx *rctx) {
+    size_t len = 0;
+    for (int i = 0; i < TEST_REPEAT; i++) {
+        memcpy(&input[len], pattern, sizeof pattern - 1);
+        len += sizeof pattern - 1;
+    }
+    *rctx = (TestLexer_ReadCtx){.data = input, .len = len};
+}
+
+void test_matches_lexer() {
+    Lexer direct, piped;
+    TestLexer_ReadCtx directCtx, pipedCtx;
+
+    Lexer_init(&direct);
+    initInput(&directCtx);
+    direct.context = &directCtx;
+    direct.readChar = (int (*)(void *))TestLexer_readChar;
+
+    Lexer_init(&piped);
+    initInput(&pipedCtx);
+    piped.context = &pipedCtx;
+    piped.readChar = (int (*)(void *))TestLexer_readChar;
+
+    // a tiny ring forces plenty of full/empty hand-offs
+    TokRing ring;
+    assert(TokRing_start(&ring, &piped, 4));
+
+    ByteBuf value;
+    ByteBuf_init(&value, 16);
+    SrcPosn start, end;
+
+    size_t count = 0;
+    for (;;) {
+        Token want = Lexer_next(&direct);
+        Token got = TokRing_pop(&ring, &start, &end, &value);
+
+        assert(got == want);
+        assert(start.row == direct.startPosn.row);
+        assert(start.col == direct.startPosn.col);
+        assert(end.row == direct.curPosn.row);
+        assert(end.col == direct.curPosn.col);
+        if (direct.tokenValue != NULL) {
+            assert(value.len > 0 && !strcmp(value.data, direct.tokenValue));
+        } else {
+            assert(value.len == 0);
+        }
+
+        if ERROR (want)
+            break;
+        count++;
+    }
+    assert(count == direct.produced);
+
+    // the terminator is replayed once reached
+    assert(TokRing_pop(&ring, &start, &end, &value) == EOF);
+
+    TokRing_cleanup(&ring);
+    ByteBuf_free(&value);
+    Lexer_cleanup(&piped);
+    Lexer_cleanup(&direct);
+}
+
+void test_early_close() {
+    Lexer lex;
+    TestLexer_ReadCtx rctx;
+
+    Lexer_init(&lex);
+    initInput(&rctx);
+    lex.context = &rctx;
+    lex.readChar = (int (*)(void *))TestLexer_readChar;
+
+    TokRing ring;
+    assert(TokRing_start(&ring, &lex, 8));
+
+    ByteBuf value;
+    ByteBuf_init(&value, 16);
+    SrcPosn start, end;
+    assert(TokRing_pop(&ring, &start, &end, &value) == Token_export);
+
+    // the producer is blocked on a full ring and has to notice the close
+    TokRing_cleanup(&ring);
+
+    ByteBuf_free(&value);
+    Lexer_cleanup(&lex);
+}
+
+int main() {
+    printf("tokring matches lexer...");
+    test_matches_lexer();
+    printf("OK!\n");
+    printf("tokring early close...");
+    test_early_close();
+    printf("OK!\n");
+}
+
+#endif
@@ -0,0 +1,86 @@
+// a bounded single-producer/single-consumer ring of lexed tokens. lets the
+// lexer run on its own thread ahead of the parser, see `TokRing_start()`.
+
+#pragma once
+
+#include "common/bytebuf.h"
+#include "gendef.h"
+#include "lexer.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+// how many tokens either side moves before publishing its position to the
+// other side.
+#define TOKRING_BATCH 32
+
+// values up to this long are kept in the slot itself
+#define TOKRING_INLINE 8
+
+// a single lexed token as handed from the producer to the consumer, packed
+// into half a cache line. positions are kept in 32 bits, as inputs over 4GiB
+// are not supported anyway.
+typedef struct TokSlot {
+    int32_t tok;
+    // length of the token value, without a terminator. 0 when the token has
+    // none.
+    uint32_t len;
+    uint32_t startRow;
+    uint32_t startCol;
+    uint32_t endRow;
+    uint32_t endCol;
+
+    // longer values are allocated by the producer from `slabAlloc` and freed
+    // by the consumer once copied out.
+    union {
+        char bytes[TOKRING_INLINE];
+        char *heap;
+    } value;
+} TokSlot;
+
+_Static_assert(sizeof(TokSlot) == 32, "TokSlot should stay 32 bytes");
+
+typedef struct TokRing {
+    // owned by the producer thread between `TokRing_start()` and
+    // `TokRing_cleanup()`.
+    Lexer *lex;
+
+    size_t mask;
+    TokSlot *slots;
+
+    thrd_t thread;
+
+    // set by the consumer to tell a blocked producer to give up.
+    atomic_bool closed;
+
+    // producer side. `head` is the published count of pushed tokens.
+    _Alignas(64) atomic_size_t head;
+    size_t pushed;
+    size_t cachedTail;
+
+    // consumer side. `tail` is the published count of popped tokens.
+    _Alignas(64) atomic_size_t tail;
+    size_t popped;
+    size_t cachedHead;
+
+    // the terminating token (EOF or a lex error), replayed by every pop once
+    // it has been reached.
+    bool done;
+    TokSlot last;
+} TokRing;
+
+// allocates a ring of at least `capacity` slots and starts lexing `lex` into
+// it on a new thread. returns false if the ring or thread could not be
+// created.
+bool TokRing_start(TokRing *ring, Lexer *lex, size_t capacity);
+
+// stops and joins the producer thread and frees the ring. the lexer is handed
+// back to the caller untouched otherwise.
+void TokRing_cleanup(TokRing *ring);
+
+// blocks until the next token is available and copies it out. `value` gets
+// the nul terminated token value, or `len == 0` if there is none.
+Token TokRing_pop(TokRing *ring, SrcPosn *start, SrcPosn *end,
+                  ByteBuf *value);